@@ -1,65 +1,309 @@
-#include <unistd.h> // mkstemp()
-#include <string.h> // strcpy()
+#include <unistd.h> // mktemp()
+#include <fcntl.h>  // O_CREAT, O_EXCL
 #include <stdio.h>	// perror()
 #include <stdlib.h>	// malloc()
+#include <errno.h>	// errno, EAGAIN
+#include <time.h>	// clock_gettime(), nanosleep()
+#include <pthread.h>	// pthread_mutex_lock(), pthread_mutex_unlock()
 
 #include "psem.h"
+#include "psem_trace.h"
 
 /*
   Unnamed POSIX semaphores are not implemented on macOS (aka OS X).
   Use named semaphores from sempahore.h to implement a generic API to
   un-named semaphores.
+
+  The name is unlinked as soon as the semaphore is opened, an open named
+  semaphore stays usable until it is closed.
 */
 
-void cleanup(psem_t *sem) {
-  if (sem_close(sem->sem) == -1) {
-    perror("sem_close()");
-    abort();
-  }
+void perror_and_abort(const char* msg) {
+  perror(msg);
+  abort();
+}
+
+static sem_t *open_named(unsigned int value) {
+  char name[] = "/tmp/semaphore.XXXXXX";
+
+  mktemp(name);
 
-  if (sem_unlink(sem->name) == -1) {
-    perror("sem_unlink()");
-    abort();
+  sem_t *sem = sem_open(name, O_CREAT | O_EXCL, 0, value);
+
+  if (sem == SEM_FAILED) {
+    perror_and_abort("sem_open()");
   }
 
-  free(sem->name);
-  free(sem);
-  sem = NULL;
+  if (sem_unlink(name) == -1) {
+    perror_and_abort("sem_unlink()");
+  }
+  return sem;
 }
 
-void perror_and_abort(psem_t *sem, const char* msg) {
-  perror(msg);
-  cleanup(sem);
-  abort();
+/* The named semaphore of sem. A semaphore set up by PSEM_INITIALIZER is
+   opened here on first use. Should two threads race to open it, the loser
+   closes its own. */
+static sem_t *open_sem(psem_t *sem) {
+  sem_t *named = atomic_load(&sem->sem);
+
+  if (named == NULL) {
+    sem_t *mine = open_named(sem->value);
+
+    if (atomic_compare_exchange_strong(&sem->sem, &named, mine)) {
+      named = mine;
+    } else {
+      sem_close(mine);
+    }
+  }
+  return named;
 }
 
 psem_t *psem_init(unsigned int value) {
   psem_t *sem = malloc(sizeof(psem_t));
 
-  sem->name = strdup("/tmp/semaphore.XXXXXX");
-  mktemp(sem->name);
-
-  sem->sem = sem_open(sem->name, O_CREAT | O_EXCL, 0, value);
-
-  if (sem->sem == SEM_FAILED) {
-    perror_and_abort(sem, "sem_open()");
+  if (sem == NULL) {
+    perror_and_abort("malloc()");
   }
+
+  psem_init_at(sem, value);
   return sem;
 }
 
+void psem_init_at(psem_t *sem, unsigned int value) {
+  sem->value = value;
+  atomic_init(&sem->sem, open_named(value));
+  pthread_mutex_init(&sem->bulk, NULL);
+
+#ifdef PSEM_TRACE
+  psem_trace_init(sem, false);
+#endif
+}
+
+void psem_init_shared_at(psem_t *sem, unsigned int value) {
+  (void) sem;
+  (void) value;
+
+  fprintf(stderr, "Process-shared semaphores are not supported on macOS\n");
+  abort();
+}
 
 void psem_wait(psem_t *sem) {
-  if (sem_wait(sem->sem) == -1) {
-    perror_and_abort(sem, "sem_wait()");
+#ifdef PSEM_TRACE
+  if (sem_trywait(open_sem(sem)) == 0) {
+    psem_trace_wait(sem, NULL);
+    return;
   }
+
+  struct timespec since;
+  timing_start(&since);
+#endif
+
+  if (sem_wait(open_sem(sem)) == -1) {
+    perror_and_abort("sem_wait()");
+  }
+
+#ifdef PSEM_TRACE
+  psem_trace_wait(sem, &since);
+#endif
+}
+
+/* psem_trywait() without tracing, for the polls of psem_timedwait(). */
+static bool try_take(psem_t *sem) {
+  if (sem_trywait(open_sem(sem)) == -1) {
+    if (errno == EAGAIN) {
+      return false;
+    }
+    perror_and_abort("sem_trywait()");
+  }
+  return true;
+}
+
+bool psem_trywait(psem_t *sem) {
+  if (!try_take(sem)) {
+    return false;
+  }
+
+#ifdef PSEM_TRACE
+  psem_trace_wait(sem, NULL);
+#endif
+  return true;
+}
+
+/*
+  Named semaphores on macOS lack sem_timedwait(). Poll with sem_trywait() and
+  sleep a short while between attempts until the deadline has passed.
+*/
+
+#define TIMEDWAIT_POLL_NS 100000
+
+bool psem_timedwait(psem_t *sem, const struct timespec *abstime) {
+  struct timespec poll = {0, TIMEDWAIT_POLL_NS};
+  struct timespec now;
+
+#ifdef PSEM_TRACE
+  if (try_take(sem)) {
+    psem_trace_wait(sem, NULL);
+    return true;
+  }
+
+  struct timespec since;
+  timing_start(&since);
+#endif
+
+  bool taken;
+
+  while (!(taken = try_take(sem))) {
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    if (now.tv_sec > abstime->tv_sec ||
+        (now.tv_sec == abstime->tv_sec && now.tv_nsec >= abstime->tv_nsec)) {
+      break;
+    }
+    nanosleep(&poll, NULL);
+  }
+
+#ifdef PSEM_TRACE
+  psem_trace_wait(sem, &since);
+#endif
+  return taken;
 }
 
 void psem_signal(psem_t *sem) {
-  if (sem_post(sem->sem) == -1) {
-    perror_and_abort(sem, "sem_post()");
+  if (sem_post(open_sem(sem)) == -1) {
+    perror_and_abort("sem_post()");
+  }
+}
+
+/*
+  Named semaphores only move one unit at a time. Bulk waiters take their
+  units one by one while holding the semaphore's bulk mutex, so that two of
+  them never each hold part of what the other needs.
+*/
+
+void psem_wait_n(psem_t *sem, unsigned int n) {
+  pthread_mutex_lock(&sem->bulk);
+
+  for (unsigned int i = 0; i < n; i++) {
+    psem_wait(sem);
+  }
+
+  pthread_mutex_unlock(&sem->bulk);
+}
+
+void psem_signal_n(psem_t *sem, unsigned int n) {
+  for (unsigned int i = 0; i < n; i++) {
+    psem_signal(sem);
   }
 }
 
 void psem_destroy(psem_t *sem) {
-  cleanup(sem);
+  psem_fini(sem);
+  free(sem);
+}
+
+void psem_fini(psem_t *sem) {
+  sem_t *named = atomic_exchange(&sem->sem, NULL);
+
+  if (named != NULL && sem_close(named) == -1) {
+    perror_and_abort("sem_close()");
+  }
+
+  pthread_mutex_destroy(&sem->bulk);
+
+#ifdef PSEM_TRACE
+  psem_trace_fini(sem);
+#endif
+}
+
+/*
+  Eventcounts. A waiter counts itself in waiters before it reads the epoch
+  as its key, and a notifier looks at waiters only after the condition it
+  notifies about has been made true, so either the waiter sees the condition
+  or the notifier sees the waiter. The notifier then advances the epoch under
+  the mutex, which the waiter holds from its last look at the epoch until it
+  waits on cond.
+*/
+
+void pevent_init_at(pevent_t *ev) {
+  atomic_init(&ev->epoch, 0);
+  atomic_init(&ev->waiters, 0);
+
+  if (pthread_mutex_init(&ev->mutex, NULL) != 0 || pthread_cond_init(&ev->cond, NULL) != 0) {
+    perror_and_abort("Initializing eventcount");
+  }
+}
+
+void pevent_init_shared_at(pevent_t *ev) {
+  (void) ev;
+
+  fprintf(stderr, "Process-shared eventcounts are not supported on macOS\n");
+  abort();
+}
+
+void pevent_fini(pevent_t *ev) {
+  pthread_mutex_destroy(&ev->mutex);
+  pthread_cond_destroy(&ev->cond);
+}
+
+unsigned int pevent_prepare_wait(pevent_t *ev) {
+  atomic_fetch_add(&ev->waiters, 1);
+  atomic_thread_fence(memory_order_seq_cst);
+
+  return atomic_load(&ev->epoch);
+}
+
+void pevent_cancel_wait(pevent_t *ev) {
+  atomic_fetch_sub(&ev->waiters, 1);
+}
+
+void pevent_commit_wait(pevent_t *ev, unsigned int key) {
+  pevent_commit_timedwait(ev, key, NULL);
+}
+
+bool pevent_commit_timedwait(pevent_t *ev, unsigned int key, const struct timespec *abstime) {
+  pthread_mutex_lock(&ev->mutex);
+
+  while (atomic_load(&ev->epoch) == key) {
+    int error = (abstime == NULL) ? pthread_cond_wait(&ev->cond, &ev->mutex)
+                                  : pthread_cond_timedwait(&ev->cond, &ev->mutex, abstime);
+    if (error == ETIMEDOUT) {
+      break;
+    }
+    if (error != 0) {
+      errno = error;
+      perror_and_abort("Waiting on eventcount");
+    }
+  }
+
+  bool notified = atomic_load(&ev->epoch) != key;
+
+  pthread_mutex_unlock(&ev->mutex);
+  atomic_fetch_sub(&ev->waiters, 1);
+  return notified;
+}
+
+static void notify(pevent_t *ev, bool all) {
+  atomic_thread_fence(memory_order_seq_cst);
+
+  if (atomic_load_explicit(&ev->waiters, memory_order_relaxed) == 0) {
+    return;
+  }
+
+  pthread_mutex_lock(&ev->mutex);
+  atomic_fetch_add(&ev->epoch, 1);
+
+  if (all) {
+    pthread_cond_broadcast(&ev->cond);
+  } else {
+    pthread_cond_signal(&ev->cond);
+  }
+  pthread_mutex_unlock(&ev->mutex);
+}
+
+void pevent_notify(pevent_t *ev) {
+  notify(ev, false);
+}
+
+void pevent_notify_all(pevent_t *ev) {
+  notify(ev, true);
 }
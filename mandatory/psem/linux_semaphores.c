@@ -1,35 +1,302 @@
+#define _GNU_SOURCE // syscall()
+
 #include <stdio.h> // perror()
 #include <stdlib.h> // malloc()
+#include <limits.h> // INT_MAX
+#include <errno.h>  // errno, EAGAIN, ETIMEDOUT, EINTR
+#include <unistd.h> // syscall()
+#include <sys/syscall.h> // SYS_futex
+#include <linux/futex.h> // FUTEX_WAIT_BITSET, FUTEX_WAKE, ...
 
 #include "psem.h"
+#include "psem_trace.h"
+
+/*
+  Semaphores built on futex(2). The counter is a 32-bit atomic that
+  psem_wait() decrements and psem_signal() increments without entering the
+  kernel. Only a thread finding the counter too low sleeps in FUTEX_WAIT on
+  the counter, and psem_signal() only issues FUTEX_WAKE when the waiters count
+  says someone may be sleeping. psem_signal_n() adds n units and wakes up to
+  n waiters with a single FUTEX_WAKE.
+
+  A waiter counts itself before it looks at the counter a last time, and a
+  signaler increments the counter before it looks at the waiters count. Both
+  use sequentially consistent atomics, so either the waiter sees the new
+  counter value or the signaler sees the waiter. The kernel checks that the
+  counter still has the value the waiter saw before putting it to sleep.
+*/
+
+_Static_assert(sizeof(atomic_uint) == 4, "A futex word is 32 bits");
+
+static long futex(atomic_uint *word, int op, unsigned int val,
+                  const struct timespec *timeout, unsigned int bitset) {
+  return syscall(SYS_futex, word, op, val, timeout, NULL, bitset);
+}
+
+/* Futexes private to the process are cheaper for the kernel to look up. */
+static int private_flag(psem_t *sem) {
+  return sem->shared ? 0 : FUTEX_PRIVATE_FLAG;
+}
+
+/* Waiters in psem_wait_n() for more than one unit count this much each, so
+   that psem_signal_n() can tell when a waiter it wakes might not be able to
+   proceed. */
+#define BULK_WAITER (1u << 16)
+
+/* Decrement the counter by n if it is at least n. Otherwise leave it and
+   store the value seen in *seen. */
+static bool take(psem_t *sem, unsigned int n, unsigned int *seen) {
+  unsigned int value = atomic_load(&sem->value);
+
+  while (value >= n) {
+    if (atomic_compare_exchange_weak_explicit(&sem->value, &value, value - n,
+                                              memory_order_acquire,
+                                              memory_order_relaxed)) {
+      return true;
+    }
+  }
+  *seen = value;
+  return false;
+}
+
+/* Wait for the counter to reach n and decrement it by n, giving up at
+   abstime unless abstime is NULL. */
+static bool wait_until(psem_t *sem, unsigned int n, const struct timespec *abstime) {
+  unsigned int seen;
+
+  if (take(sem, n, &seen)) {
+#ifdef PSEM_TRACE
+    psem_trace_wait(sem, NULL);
+#endif
+    return true;
+  }
+
+#ifdef PSEM_TRACE
+  struct timespec since;
+  timing_start(&since);
+#endif
+
+  // An absolute timeout on CLOCK_REALTIME needs FUTEX_WAIT_BITSET.
+  int op = FUTEX_WAIT_BITSET | private_flag(sem);
+
+  if (abstime != NULL) {
+    op |= FUTEX_CLOCK_REALTIME;
+  }
+
+  unsigned int weight = (n > 1) ? BULK_WAITER : 1;
+
+  atomic_fetch_add(&sem->waiters, weight);
+
+  bool taken;
+
+  while (!(taken = take(sem, n, &seen))) {
+    if (futex(&sem->value, op, seen, abstime, FUTEX_BITSET_MATCH_ANY) == -1) {
+      if (errno == ETIMEDOUT) {
+        taken = take(sem, n, &seen);
+        break;
+      }
+      // EAGAIN: the counter had changed.
+      if (errno != EAGAIN && errno != EINTR) {
+        perror("Wating on sempahore failed");
+        abort();
+      }
+    }
+  }
+
+  atomic_fetch_sub(&sem->waiters, weight);
+
+#ifdef PSEM_TRACE
+  psem_trace_wait(sem, &since);
+#endif
+  return taken;
+}
 
 psem_t *psem_init(unsigned int value) {
-  psem_t *sem = malloc(sizeof(sem_t));
+  psem_t *sem = malloc(sizeof(psem_t));
+
+  if (sem == NULL) {
+    perror("Initializing new semaphore");
+    abort();
+  }
+
+  psem_init_at(sem, value);
+  return sem;
+}
 
- if (sem_init(sem, 0, value) == -1) {
-   perror("Initializing new semaphore");
-   abort();
- }
- return sem;
+void psem_init_at(psem_t *sem, unsigned int value) {
+  atomic_init(&sem->value, value);
+  atomic_init(&sem->waiters, 0);
+  sem->shared = false;
+
+#ifdef PSEM_TRACE
+  psem_trace_init(sem, false);
+#endif
+}
+
+void psem_init_shared_at(psem_t *sem, unsigned int value) {
+  psem_init_at(sem, value);
+  sem->shared = true;
+
+#ifdef PSEM_TRACE
+  psem_trace_init(sem, true);
+#endif
 }
 
 void psem_wait(psem_t *sem) {
-  if (sem_wait(sem) == -1) {
-    perror("Wating on sempahore failed");
-    abort();
+  wait_until(sem, 1, NULL);
+}
+
+void psem_wait_n(psem_t *sem, unsigned int n) {
+  if (n > 0) {
+    wait_until(sem, n, NULL);
   }
 }
 
+bool psem_trywait(psem_t *sem) {
+  unsigned int seen;
+
+  if (!take(sem, 1, &seen)) {
+    return false;
+  }
+
+#ifdef PSEM_TRACE
+  psem_trace_wait(sem, NULL);
+#endif
+  return true;
+}
+
+bool psem_timedwait(psem_t *sem, const struct timespec *abstime) {
+  return wait_until(sem, 1, abstime);
+}
+
 void psem_signal(psem_t *sem) {
-  if (sem_post(sem) == -1) {
+  psem_signal_n(sem, 1);
+}
+
+void psem_signal_n(psem_t *sem, unsigned int n) {
+  if (n == 0) {
+    return;
+  }
+
+  atomic_fetch_add(&sem->value, n);
+
+  unsigned int waiters = atomic_load(&sem->waiters);
+
+  if (waiters == 0) {
+    return;
+  }
+
+  // A woken bulk waiter may find too few units and go back to sleep without
+  // passing the wake-up on, so with bulk waiters around everyone is woken.
+  int wake = (waiters >= BULK_WAITER) ? INT_MAX : (int) ((n < waiters) ? n : waiters);
+
+  if (futex(&sem->value, FUTEX_WAKE | private_flag(sem), wake, NULL, 0) == -1) {
     perror("Signaling on semaphore failed");
     abort();
   }
 }
 
 void psem_destroy(psem_t *sem) {
-  if (sem_destroy(sem) == -1) {
-    perror("Destroying semaphore failed");
+  psem_fini(sem);
+  free(sem);
+}
+
+void psem_fini(psem_t *sem) {
+  (void) sem;
+
+#ifdef PSEM_TRACE
+  psem_trace_fini(sem);
+#endif
+}
+
+/*
+  Eventcounts. A waiter counts itself in waiters before it reads the epoch
+  as its key, and a notifier looks at waiters only after the condition it
+  notifies about has been made true. With full fences on both sides either
+  the waiter sees the condition or the notifier sees the waiter and advances
+  the epoch, which makes the kernel refuse to put a waiter with the old key
+  to sleep.
+*/
+
+static int event_private_flag(pevent_t *ev) {
+  return ev->shared ? 0 : FUTEX_PRIVATE_FLAG;
+}
+
+void pevent_init_at(pevent_t *ev) {
+  atomic_init(&ev->epoch, 0);
+  atomic_init(&ev->waiters, 0);
+  ev->shared = false;
+}
+
+void pevent_init_shared_at(pevent_t *ev) {
+  pevent_init_at(ev);
+  ev->shared = true;
+}
+
+void pevent_fini(pevent_t *ev) {
+  (void) ev;
+}
+
+unsigned int pevent_prepare_wait(pevent_t *ev) {
+  atomic_fetch_add(&ev->waiters, 1);
+  atomic_thread_fence(memory_order_seq_cst);
+
+  return atomic_load(&ev->epoch);
+}
+
+void pevent_cancel_wait(pevent_t *ev) {
+  atomic_fetch_sub(&ev->waiters, 1);
+}
+
+void pevent_commit_wait(pevent_t *ev, unsigned int key) {
+  pevent_commit_timedwait(ev, key, NULL);
+}
+
+bool pevent_commit_timedwait(pevent_t *ev, unsigned int key, const struct timespec *abstime) {
+  int op = FUTEX_WAIT_BITSET | event_private_flag(ev);
+
+  if (abstime != NULL) {
+    op |= FUTEX_CLOCK_REALTIME;
+  }
+
+  while (atomic_load(&ev->epoch) == key) {
+    if (futex(&ev->epoch, op, key, abstime, FUTEX_BITSET_MATCH_ANY) == -1) {
+      if (errno == ETIMEDOUT) {
+        break;
+      }
+      // EAGAIN: the epoch had advanced.
+      if (errno != EAGAIN && errno != EINTR) {
+        perror("Waiting on eventcount failed");
+        abort();
+      }
+    }
+  }
+
+  bool notified = atomic_load(&ev->epoch) != key;
+
+  atomic_fetch_sub(&ev->waiters, 1);
+  return notified;
+}
+
+static void notify(pevent_t *ev, int wake) {
+  atomic_thread_fence(memory_order_seq_cst);
+
+  if (atomic_load_explicit(&ev->waiters, memory_order_relaxed) == 0) {
+    return;
+  }
+
+  atomic_fetch_add(&ev->epoch, 1);
+
+  if (futex(&ev->epoch, FUTEX_WAKE | event_private_flag(ev), wake, NULL, 0) == -1) {
+    perror("Notifying eventcount failed");
     abort();
   }
 }
+
+void pevent_notify(pevent_t *ev) {
+  notify(ev, 1);
+}
+
+void pevent_notify_all(pevent_t *ev) {
+  notify(ev, INT_MAX);
+}
@@ -0,0 +1,273 @@
+#define _DEFAULT_SOURCE  // MAP_ANON on Linux
+#define _DARWIN_C_SOURCE // MAP_ANON on macOS
+
+#include <stdio.h>    // fprintf(), fopen(), fscanf()
+#include <stdlib.h>   // abort(), malloc()
+#include <unistd.h>   // sysconf()
+#include <sched.h>    // sched_yield()
+#include <sys/mman.h> // mmap(), munmap()
+
+#include "pbarrier.h"
+
+/* Times a spinning waiter looks at phase before it starts yielding the
+   processor to threads that have yet to arrive. */
+#define BARRIER_SPIN 100
+
+static void init(pbarrier_t *barrier, unsigned int n, bool spin) {
+  if (n == 0) {
+    fprintf(stderr, "A barrier needs at least one thread\n");
+    abort();
+  }
+
+  barrier->n = n;
+  barrier->spin = spin;
+  atomic_init(&barrier->arrived, 0);
+  atomic_init(&barrier->phase, 0);
+  pevent_init_at(&barrier->event);
+}
+
+void pbarrier_init_at(pbarrier_t *barrier, unsigned int n) {
+  init(barrier, n, false);
+}
+
+void pbarrier_init_spin_at(pbarrier_t *barrier, unsigned int n) {
+  init(barrier, n, true);
+}
+
+void pbarrier_fini(pbarrier_t *barrier) {
+  pevent_fini(&barrier->event);
+}
+
+/* Count the calling thread in arrived, reading the phase it arrives for into
+   *phase first. Returns true for the last of expected threads to arrive,
+   which resets arrived. It must then reverse the sense with release(), as
+   threads may arrive for the next phase as soon as they see it reversed. */
+static bool arrive(atomic_uint *arrived, atomic_uint *phase_of, unsigned int expected,
+                   unsigned int *phase) {
+  *phase = atomic_load_explicit(phase_of, memory_order_acquire);
+
+  if (atomic_fetch_add_explicit(arrived, 1, memory_order_acq_rel) + 1 == expected) {
+    atomic_store_explicit(arrived, 0, memory_order_relaxed);
+    return true;
+  }
+  return false;
+}
+
+static void release(atomic_uint *phase_of, unsigned int phase, bool spin, pevent_t *event) {
+  atomic_store_explicit(phase_of, phase + 1, memory_order_release);
+
+  if (!spin) {
+    pevent_notify_all(event);
+  }
+}
+
+/* Wait until the sense has been reversed after phase. */
+static void await(atomic_uint *phase_of, unsigned int phase, bool spin, pevent_t *event) {
+  if (spin) {
+    int spins = 0;
+
+    while (atomic_load_explicit(phase_of, memory_order_acquire) == phase) {
+      if (++spins >= BARRIER_SPIN) {
+        sched_yield();
+      }
+    }
+    return;
+  }
+
+  while (atomic_load_explicit(phase_of, memory_order_acquire) == phase) {
+    unsigned int key = pevent_prepare_wait(event);
+
+    if (atomic_load_explicit(phase_of, memory_order_acquire) != phase) {
+      pevent_cancel_wait(event);
+      break;
+    }
+    pevent_commit_wait(event, key);
+  }
+}
+
+bool pbarrier_wait(pbarrier_t *barrier) {
+  unsigned int phase;
+
+  if (arrive(&barrier->arrived, &barrier->phase, barrier->n, &phase)) {
+    release(&barrier->phase, phase, barrier->spin, &barrier->event);
+    return true;
+  }
+
+  await(&barrier->phase, phase, barrier->spin, &barrier->event);
+  return false;
+}
+
+/*******************************************************************************
+                            Combining tree barrier
+********************************************************************************/
+
+/* The number of NUMA nodes of the machine, 1 if unknown. The online file
+   lists them as ranges such as 0-3 or 0,2-3. */
+static unsigned int numa_nodes(void) {
+  FILE *online = fopen("/sys/devices/system/node/online", "r");
+  unsigned int nodes = 0, first, last;
+
+  if (online == NULL) {
+    return 1;
+  }
+
+  while (fscanf(online, "%u", &first) == 1) {
+    last = first;
+
+    int c = fgetc(online);
+
+    if (c == '-' && fscanf(online, "%u", &last) == 1) {
+      c = fgetc(online);
+    }
+    nodes += last - first + 1;
+
+    if (c != ',') break;
+  }
+
+  fclose(online);
+  return (nodes > 0) ? nodes : 1;
+}
+
+static struct pbarrier_node *node_at(pbarrier_tree_t *barrier, unsigned int i) {
+  return (struct pbarrier_node *) (barrier->nodes + i*barrier->stride);
+}
+
+static void tree_init(pbarrier_tree_t *barrier, unsigned int n, unsigned int fanout, bool spin) {
+  if (n == 0 || fanout < 2) {
+    fprintf(stderr, "A tree barrier needs at least one thread and a fanout of at least two\n");
+    abort();
+  }
+
+  barrier->n = n;
+  barrier->fanout = fanout;
+  barrier->spin = spin;
+
+  // Lay out the levels, the leaves taking the threads and each level above
+  // taking the nodes of the level below, up to a single root.
+  unsigned int below = n;
+
+  barrier->levels = 0;
+  barrier->num_nodes = 0;
+
+  do {
+    barrier->first[barrier->levels++] = barrier->num_nodes;
+    below = (below + fanout - 1) / fanout;
+    barrier->num_nodes += below;
+  } while (below > 1);
+
+  barrier->expected = malloc(barrier->num_nodes*sizeof(unsigned int));
+
+  if (barrier->expected == NULL) {
+    perror("Initializing tree barrier");
+    abort();
+  }
+
+  below = n;
+
+  for (unsigned int level = 0; level < barrier->levels; level++) {
+    unsigned int count = (below + fanout - 1) / fanout;
+
+    for (unsigned int j = 0; j < count; j++) {
+      unsigned int rest = below - j*fanout;
+
+      barrier->expected[barrier->first[level] + j] = (rest < fanout) ? rest : fanout;
+    }
+    below = count;
+  }
+
+  // Anonymous memory reads as zero, the initial state of a node, so the
+  // nodes are left for the threads arriving at them to touch first.
+  barrier->stride = sizeof(struct pbarrier_node);
+
+  if (numa_nodes() > 1) {
+    size_t page = sysconf(_SC_PAGESIZE);
+
+    barrier->stride = (barrier->stride + page - 1) / page * page;
+  }
+
+  barrier->nodes = mmap(NULL, barrier->num_nodes*barrier->stride, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANON, -1, 0);
+
+  if (barrier->nodes == MAP_FAILED) {
+    perror("Initializing tree barrier");
+    abort();
+  }
+
+  barrier->events = NULL;
+
+  if (!spin) {
+    barrier->events = malloc(barrier->num_nodes*sizeof(pevent_t));
+
+    if (barrier->events == NULL) {
+      perror("Initializing tree barrier");
+      abort();
+    }
+
+    for (unsigned int i = 0; i < barrier->num_nodes; i++) {
+      pevent_init_at(&barrier->events[i]);
+    }
+  }
+}
+
+void pbarrier_tree_init_at(pbarrier_tree_t *barrier, unsigned int n, unsigned int fanout) {
+  tree_init(barrier, n, fanout, false);
+}
+
+void pbarrier_tree_init_spin_at(pbarrier_tree_t *barrier, unsigned int n, unsigned int fanout) {
+  tree_init(barrier, n, fanout, true);
+}
+
+void pbarrier_tree_fini(pbarrier_tree_t *barrier) {
+  if (barrier->events != NULL) {
+    for (unsigned int i = 0; i < barrier->num_nodes; i++) {
+      pevent_fini(&barrier->events[i]);
+    }
+    free(barrier->events);
+    barrier->events = NULL;
+  }
+
+  munmap(barrier->nodes, barrier->num_nodes*barrier->stride);
+  barrier->nodes = NULL;
+
+  free(barrier->expected);
+  barrier->expected = NULL;
+}
+
+bool pbarrier_tree_wait(pbarrier_tree_t *barrier, unsigned int id) {
+  unsigned int won[PBARRIER_TREE_DEPTH];     // Nodes this thread went up from.
+  unsigned int phases[PBARRIER_TREE_DEPTH];  // The phase of each.
+  unsigned int index = id;
+  unsigned int level = 0;
+  bool root = false;
+
+  // Go up as long as this thread is the last to arrive at its node.
+  for (;;) {
+    index /= barrier->fanout;
+
+    unsigned int i = barrier->first[level] + index;
+    struct pbarrier_node *node = node_at(barrier, i);
+    pevent_t *event = barrier->spin ? NULL : &barrier->events[i];
+
+    if (!arrive(&node->arrived, &node->phase, barrier->expected[i], &phases[level])) {
+      await(&node->phase, phases[level], barrier->spin, event);
+      break;
+    }
+
+    won[level++] = i;
+
+    if (level == barrier->levels) {
+      root = true;
+      break;
+    }
+  }
+
+  // Release the nodes this thread went up from, from the top down.
+  while (level > 0) {
+    unsigned int i = won[--level];
+    pevent_t *event = barrier->spin ? NULL : &barrier->events[i];
+
+    release(&node_at(barrier, i)->phase, phases[level], barrier->spin, event);
+  }
+
+  return root;
+}
@@ -0,0 +1,123 @@
+/*
+  Reusable barriers for a fixed number of threads working in phases, to go
+  with the semaphores of psem.h.
+
+  A spinning barrier keeps waiting threads on the processor and suits phases
+  that end close together with no more threads than processors. A blocking
+  barrier puts waiting threads to sleep on an eventcount, see pevent_t.
+
+  As with psem.h, on error all functions print an error message and terminate
+  the program.
+*/
+
+#ifndef PBARRIER_H
+#define PBARRIER_H
+
+#include <stdatomic.h> // atomic_uint
+#include <stdbool.h>   // bool
+#include <stddef.h>    // size_t
+
+#include "psem.h"      // pevent_t
+
+#define PBARRIER_LINE_SIZE 64
+
+/* Threads count themselves in arrived. The last one to arrive starts the
+   next phase by resetting arrived and flipping the low bit of phase, the
+   sense the others wait to see reversed. The two counters are on separate
+   cache lines, so that arriving threads do not disturb the waiting ones. */
+typedef struct {
+  unsigned int n;
+  bool         spin;
+  _Alignas(PBARRIER_LINE_SIZE) atomic_uint arrived;
+  _Alignas(PBARRIER_LINE_SIZE) atomic_uint phase;
+  pevent_t     event;  // Blocking barriers only.
+} pbarrier_t;
+
+/* pbarrier_init_at(barrier, n)
+   pbarrier_init_spin_at(barrier, n)
+
+   Initialize a blocking or a spinning barrier for n threads, at least one, in
+   storage provided by the caller. Finalized with pbarrier_fini().
+*/
+void pbarrier_init_at(pbarrier_t *barrier, unsigned int n);
+void pbarrier_init_spin_at(pbarrier_t *barrier, unsigned int n);
+void pbarrier_fini(pbarrier_t *barrier);
+
+/* pbarrier_wait(barrier)
+
+   Waits until all n threads have called pbarrier_wait() for the current
+   phase. The barrier is then ready for the next phase at once.
+
+   Return value
+
+   True in exactly one of the n threads, the last to arrive, and false in the
+   others, for example to let one thread act on the results of the phase.
+*/
+bool pbarrier_wait(pbarrier_t *barrier);
+
+/*******************************************************************************
+                            Combining tree barrier
+********************************************************************************/
+
+/* With many threads, a flat barrier has every arrival hit the same cache
+   line. A combining tree barrier splits the threads into groups of fanout,
+   each arriving at a leaf node of their own. The last thread to arrive at a
+   node goes on to arrive at the node's parent, and so on up to the root. The
+   last thread at the root releases the root, and every thread that went up
+   from a node releases that node once the node above it is released, so the
+   release travels down the tree level by level. Waiters only watch the node
+   they arrived at last.
+
+   The state of a node is only written by threads arriving at it. On a machine
+   with more than one NUMA node, see /sys/devices/system/node, each node of
+   the tree gets a page of its own that is first touched, and therefore
+   placed, by the threads arriving at it rather than by the initializing
+   thread. Threads with nearby ids should then run on the same NUMA node. */
+
+/* A node of the tree, aligned to a cache line or, with several NUMA nodes,
+   to a page. */
+struct pbarrier_node {
+  _Alignas(PBARRIER_LINE_SIZE) atomic_uint arrived;
+  _Alignas(PBARRIER_LINE_SIZE) atomic_uint phase;
+};
+
+/* The largest number of levels of a tree. */
+#define PBARRIER_TREE_DEPTH 32
+
+typedef struct {
+  unsigned int n;
+  unsigned int fanout;
+  bool         spin;
+  unsigned int levels;
+  unsigned int first[PBARRIER_TREE_DEPTH];  // Index of the first node of each level.
+  unsigned int num_nodes;
+  size_t       stride;                      // Bytes from one node to the next.
+  unsigned char *nodes;                     // The nodes, leaves first and the root last.
+  unsigned int *expected;                   // Arrivals at each node per phase.
+  pevent_t     *events;                     // Blocking barriers only, one per node.
+} pbarrier_tree_t;
+
+/* pbarrier_tree_init_at(barrier, n, fanout)
+   pbarrier_tree_init_spin_at(barrier, n, fanout)
+
+   Initialize a blocking or a spinning combining tree barrier for n threads,
+   at least one, with up to fanout, at least two, threads or nodes arriving
+   at each node. Finalized with pbarrier_tree_fini().
+*/
+void pbarrier_tree_init_at(pbarrier_tree_t *barrier, unsigned int n, unsigned int fanout);
+void pbarrier_tree_init_spin_at(pbarrier_tree_t *barrier, unsigned int n, unsigned int fanout);
+void pbarrier_tree_fini(pbarrier_tree_t *barrier);
+
+/* pbarrier_tree_wait(barrier, id)
+
+   Like pbarrier_wait(), for the thread with the given id from 0 to n - 1.
+   Each of the n threads must use an id of its own. Threads with ids close to
+   each other share the nodes close to the leaves.
+
+   Return value
+
+   True in exactly one of the n threads and false in the others.
+*/
+bool pbarrier_tree_wait(pbarrier_tree_t *barrier, unsigned int id);
+
+#endif
@@ -0,0 +1,146 @@
+#define _GNU_SOURCE // sched_getcpu()
+
+#include <stdbool.h> // bool
+#include <stdio.h>   // perror()
+#include <stdlib.h>  // aligned_alloc(), malloc(), abort()
+#include <unistd.h>  // sysconf()
+#include <sched.h>   // sched_getcpu()
+#include <time.h>    // clock_gettime()
+
+#include "pcounter.h"
+
+/* Index of the calling thread, from 1 and 0 until the thread first updates a
+   counter. Threads keep their index for all counters. */
+static _Thread_local unsigned int thread_index;
+static atomic_uint next_thread_index;
+
+static struct pcounter_shard *shard_of(pcounter_t *counter) {
+  unsigned int index;
+
+#ifdef __linux__
+  if (counter->flags & PCOUNTER_PER_CPU) {
+    int cpu = sched_getcpu();
+
+    if (cpu >= 0) {
+      return &counter->shards[cpu % counter->num_shards];
+    }
+  }
+#endif
+
+  if (thread_index == 0) {
+    thread_index = atomic_fetch_add_explicit(&next_thread_index, 1, memory_order_relaxed) + 1;
+  }
+  index = thread_index - 1;
+
+  return &counter->shards[index % counter->num_shards];
+}
+
+static uint64_t now(void) {
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+    perror("Reading counter");
+    abort();
+  }
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+pcounter_t *pcounter_init(unsigned int num_shards, int flags) {
+  pcounter_t *counter = aligned_alloc(PCOUNTER_LINE_SIZE, sizeof(pcounter_t));
+
+  if (counter == NULL) {
+    perror("Initializing new counter");
+    abort();
+  }
+
+  pcounter_init_at(counter, num_shards, flags);
+  return counter;
+}
+
+void pcounter_init_at(pcounter_t *counter, unsigned int num_shards, int flags) {
+  if (num_shards == 0) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+
+    num_shards = (online > 0) ? online : 1;
+  }
+
+  counter->num_shards = num_shards;
+  counter->flags = flags;
+  counter->shards = aligned_alloc(PCOUNTER_LINE_SIZE, num_shards*sizeof(struct pcounter_shard));
+
+  if (counter->shards == NULL) {
+    perror("Initializing counter");
+    abort();
+  }
+
+  for (unsigned int i = 0; i < num_shards; i++) {
+    atomic_init(&counter->shards[i].value, 0);
+  }
+
+  counter->staleness = 0;
+  atomic_init(&counter->cached, 0);
+  atomic_init(&counter->stamp, 0);
+  atomic_init(&counter->refreshing, false);
+}
+
+void pcounter_destroy(pcounter_t *counter) {
+  pcounter_fini(counter);
+  free(counter);
+}
+
+void pcounter_fini(pcounter_t *counter) {
+  free(counter->shards);
+  counter->shards = NULL;
+}
+
+void pcounter_add(pcounter_t *counter, long delta) {
+  atomic_fetch_add_explicit(&shard_of(counter)->value, delta, memory_order_relaxed);
+}
+
+static long sum(pcounter_t *counter) {
+  long total = 0;
+
+  for (unsigned int i = 0; i < counter->num_shards; i++) {
+    total += atomic_load_explicit(&counter->shards[i].value, memory_order_relaxed);
+  }
+  return total;
+}
+
+/*
+  An approximate read returns cached as long as stamp, the time just before
+  the shards were last summed, is recent enough. Otherwise one reader at a
+  time, the one that sets refreshing, sums the shards and stores the sum in
+  cached before it moves stamp on, so a reader that sees the new stamp also
+  sees the new sum. Readers finding another reader summing sum the shards
+  themselves rather than wait or return a sum that may be too old.
+*/
+long pcounter_read(pcounter_t *counter) {
+  if (counter->staleness == 0) {
+    return sum(counter);
+  }
+
+  uint64_t start = now();
+  uint64_t stamp = atomic_load_explicit(&counter->stamp, memory_order_acquire);
+
+  // A stamp of 0 means there is no sum yet.
+  if (stamp != 0 && start - stamp <= counter->staleness) {
+    return atomic_load_explicit(&counter->cached, memory_order_relaxed);
+  }
+
+  long total;
+
+  if (!atomic_exchange_explicit(&counter->refreshing, true, memory_order_acquire)) {
+    total = sum(counter);
+    atomic_store_explicit(&counter->cached, total, memory_order_relaxed);
+    atomic_store_explicit(&counter->stamp, start, memory_order_release);
+    atomic_store_explicit(&counter->refreshing, false, memory_order_release);
+  } else {
+    total = sum(counter);
+  }
+  return total;
+}
+
+void pcounter_approximate(pcounter_t *counter, uint64_t staleness) {
+  counter->staleness = staleness;
+  atomic_store(&counter->stamp, 0);
+}
@@ -0,0 +1,97 @@
+/*
+  A statistics counter for many threads, such as a count of requests served.
+
+  A single atomic counter updated by many threads moves its cache line from
+  processor to processor on every update. A pcounter_t spreads the updates
+  over shards, each on a cache line of its own, so that threads updating the
+  counter at the same time rarely touch the same line. Reading the counter
+  sums the shards, which is slower than reading a single counter and suits
+  counters that are updated far more often than they are read.
+
+  Each thread updates a shard of its own, handed out round robin the first
+  time the thread updates any pcounter_t. With PCOUNTER_PER_CPU, threads
+  instead update the shard of the CPU they run on, for when there are many
+  more threads than CPUs. Threads share shards when there are more threads or
+  CPUs than shards, which costs speed but never counts.
+
+  As with psem.h, on error all functions print an error message and terminate
+  the program.
+*/
+
+#ifndef PCOUNTER_H
+#define PCOUNTER_H
+
+#include <stdatomic.h> // atomic_long
+#include <stdint.h>    // uint64_t
+
+#define PCOUNTER_LINE_SIZE 64
+
+/* Update the shard of the CPU rather than the shard of the thread. Only
+   supported on Linux, elsewhere threads keep to their own shard. */
+#define PCOUNTER_PER_CPU 1
+
+struct pcounter_shard {
+  _Alignas(PCOUNTER_LINE_SIZE) atomic_long value;
+};
+
+typedef struct {
+  unsigned int num_shards;
+  int          flags;
+  struct pcounter_shard *shards;
+
+  /* Sum of the shards at stamp, nanoseconds on the monotonic clock, for
+     approximate reads. See pcounter_approximate(). */
+  uint64_t     staleness;
+  _Alignas(PCOUNTER_LINE_SIZE) atomic_long cached;
+  _Atomic uint64_t stamp;
+  atomic_bool  refreshing;
+} pcounter_t;
+
+/* pcounter_init(num_shards, flags)
+   pcounter_init_at(counter, num_shards, flags)
+
+   Initializes a new counter, or one in storage provided by the caller, to
+   zero with num_shards shards, or one per online processor if num_shards is
+   0. flags is 0 or PCOUNTER_PER_CPU. A counter from pcounter_init() is freed
+   by pcounter_destroy() and one from pcounter_init_at() is finalized by
+   pcounter_fini().
+*/
+pcounter_t *pcounter_init(unsigned int num_shards, int flags);
+void pcounter_init_at(pcounter_t *counter, unsigned int num_shards, int flags);
+void pcounter_destroy(pcounter_t *counter);
+void pcounter_fini(pcounter_t *counter);
+
+/* pcounter_add(counter, delta)
+
+   Adds delta, which may be negative, to the counter. Wait-free, a single
+   relaxed atomic addition to a shard. The addition orders no other memory
+   accesses of the thread.
+*/
+void pcounter_add(pcounter_t *counter, long delta);
+
+/* pcounter_read(counter)
+
+   Return value
+
+   The sum of the shards. Additions made before the call by the calling
+   thread, or by threads joined by it, are counted. Additions made during the
+   call may or may not be, so while the counter is being updated the sum need
+   not be a value the counter ever held. For a counter that only grows it lies
+   between the values at the start and at the end of the call.
+
+   An approximate counter, see pcounter_approximate(), returns a sum taken at
+   most its staleness ago instead, summing the shards only when that sum has
+   grown too old.
+*/
+long pcounter_read(pcounter_t *counter);
+
+/* pcounter_approximate(counter, staleness)
+
+   Lets pcounter_read() return a sum of the shards up to staleness
+   nanoseconds old, so that frequent readers share one sum rather than each
+   summing the shards. A staleness of 0 makes reads exact again. Must not be
+   called while other threads read the counter.
+*/
+void pcounter_approximate(pcounter_t *counter, uint64_t staleness);
+
+#endif
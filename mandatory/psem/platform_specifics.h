@@ -1,14 +1,88 @@
-#include <semaphore.h>	// sem_open(), sem_close(), sem_unlink(), sem_wait(), sem_post()
+#include <stdatomic.h> // atomic_uint
+#include <stdbool.h>   // bool
+
+#ifdef PSEM_TRACE
+
+/* Number of buckets of the blocked time histogram. Bucket i counts waits that
+   blocked for at least 2^i and less than 2^(i+1) nanoseconds, the last bucket
+   also longer ones. */
+#define PSEM_TRACE_BUCKETS 32
+
+/* Wait statistics of a semaphore, kept in PSEM_TRACE builds only. */
+struct psem_trace {
+  const char *name;                    // Set by psem_trace_name().
+  atomic_ullong waits;                 // Waits, blocking or not.
+  atomic_ullong blocked;               // Waits that blocked.
+  atomic_ullong blocked_ns;            // Total time blocked.
+  atomic_ullong max_ns;                // Longest time blocked.
+  atomic_ullong histogram[PSEM_TRACE_BUCKETS];
+  bool shared;                         // Process-shared, never listed.
+  atomic_bool listed;                  // On the list of traced semaphores.
+  struct psem_trace *next;             // Next on that list.
+};
+
+#define PSEM_TRACE_INITIALIZER , { 0 }
+
+#else
+
+#define PSEM_TRACE_INITIALIZER
+
+#endif
 
 #ifdef __linux__
-typedef sem_t psem_t;
+
+/* The counter is the futex word that waiters sleep on. Waiters counts threads
+   blocked, or about to block, in the kernel, so that signaling only enters the
+   kernel when there is someone to wake. A shared semaphore uses futexes that
+   work across processes. */
+typedef struct {
+  atomic_uint value;
+  atomic_uint waiters;
+  bool shared;
+#ifdef PSEM_TRACE
+  struct psem_trace trace;
+#endif
+} psem_t;
+
+#define PSEM_INITIALIZER(value) { (value), 0, false PSEM_TRACE_INITIALIZER }
+
+/* Waiters sleep on the epoch as a futex word until a notifier advances it. */
+typedef struct {
+  atomic_uint epoch;
+  atomic_uint waiters;
+  bool shared;
+} pevent_t;
+
+#define PEVENT_INITIALIZER { 0, 0, false }
+
 #endif
 
 #ifdef __APPLE__
 
+#include <semaphore.h>	// sem_open(), sem_close(), sem_unlink(), sem_wait(), sem_post()
+#include <pthread.h>    // pthread_mutex_t, pthread_cond_t
+
+/* Named semaphores cannot be created at compile time. A semaphore set up by
+   PSEM_INITIALIZER is opened on first use, see open_sem(). */
 typedef struct {
-  char *name;
-  sem_t *sem;
+  _Atomic(sem_t *) sem;
+  unsigned int value;
+  pthread_mutex_t bulk;  // Serializes psem_wait_n().
+#ifdef PSEM_TRACE
+  struct psem_trace trace;
+#endif
 } psem_t;
 
+#define PSEM_INITIALIZER(value) { NULL, (value), PTHREAD_MUTEX_INITIALIZER PSEM_TRACE_INITIALIZER }
+
+/* Waiters sleep on cond until a notifier advances the epoch under mutex. */
+typedef struct {
+  atomic_uint epoch;
+  atomic_uint waiters;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+} pevent_t;
+
+#define PEVENT_INITIALIZER { 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER }
+
 #endif
@@ -0,0 +1,214 @@
+#include <stdbool.h> // bool
+#include <stdio.h>   // perror()
+#include <stdlib.h>  // malloc(), aligned_alloc(), abort()
+#include <string.h>  // strerror()
+#include <sched.h>   // sched_yield()
+
+#include "plock.h"
+
+static void check(int error, const char *what) {
+  if (error != 0) {
+    fprintf(stderr, "%s: %s\n", what, strerror(error));
+    abort();
+  }
+}
+
+/*******************************************************************************
+                              Reader-writer lock
+********************************************************************************/
+
+/*
+  The state word holds the number of readers in the lock in its low 16 bits,
+  the number of writers waiting for the lock in the next 15 bits and whether a
+  writer holds the lock in the top bit. Readers and writers take and release
+  the lock with a compare-and-swap on state and only enter the mutex to sleep
+  and to wake sleepers.
+
+  A thread about to sleep counts itself in sleepers and tries state a last
+  time while holding the mutex. A thread releasing the lock changes state and
+  only then looks at sleepers. Both use sequentially consistent atomics, so
+  either the sleeper sees the release or the releaser sees the sleeper, and
+  then takes the mutex before it broadcasts on cond, which the sleeper only
+  lets go of by waiting on cond.
+*/
+
+#define READER        1u
+#define READERS       0xffffu
+#define WRITER_WAITS  (1u << 16)
+#define WRITERS_WAIT  (0x7fffu << 16)
+#define WRITER        (1u << 31)
+
+/* Take the lock for reading, unless a writer holds it or waits for it. */
+static bool try_read(prwlock_t *lock) {
+  unsigned int state = atomic_load(&lock->state);
+
+  while (!(state & (WRITER | WRITERS_WAIT))) {
+    if (atomic_compare_exchange_weak(&lock->state, &state, state + READER)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Take the lock for writing, as a writer counted among the waiting ones. */
+static bool try_write(prwlock_t *lock) {
+  unsigned int state = atomic_load(&lock->state);
+
+  while (!(state & (WRITER | READERS))) {
+    if (atomic_compare_exchange_weak(&lock->state, &state,
+                                     (state - WRITER_WAITS) | WRITER)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void sleep_until(prwlock_t *lock, bool (*try)(prwlock_t *)) {
+  check(pthread_mutex_lock(&lock->mutex), "Locking reader-writer lock failed");
+  atomic_fetch_add(&lock->sleepers, 1);
+
+  while (!try(lock)) {
+    check(pthread_cond_wait(&lock->cond, &lock->mutex), "Waiting on reader-writer lock failed");
+  }
+
+  atomic_fetch_sub(&lock->sleepers, 1);
+  check(pthread_mutex_unlock(&lock->mutex), "Waiting on reader-writer lock failed");
+}
+
+/* Wake all sleepers, which take the lock in whatever order they manage to. */
+static void wake(prwlock_t *lock) {
+  if (atomic_load(&lock->sleepers) == 0) {
+    return;
+  }
+
+  check(pthread_mutex_lock(&lock->mutex), "Unlocking reader-writer lock failed");
+  check(pthread_cond_broadcast(&lock->cond), "Unlocking reader-writer lock failed");
+  check(pthread_mutex_unlock(&lock->mutex), "Unlocking reader-writer lock failed");
+}
+
+prwlock_t *prwlock_init(void) {
+  prwlock_t *lock = malloc(sizeof(prwlock_t));
+
+  if (lock == NULL) {
+    perror("Initializing new reader-writer lock");
+    abort();
+  }
+
+  prwlock_init_at(lock);
+  return lock;
+}
+
+void prwlock_init_at(prwlock_t *lock) {
+  atomic_init(&lock->state, 0);
+  atomic_init(&lock->sleepers, 0);
+  check(pthread_mutex_init(&lock->mutex, NULL), "Initializing reader-writer lock");
+  check(pthread_cond_init(&lock->cond, NULL), "Initializing reader-writer lock");
+}
+
+void prwlock_destroy(prwlock_t *lock) {
+  prwlock_fini(lock);
+  free(lock);
+}
+
+void prwlock_fini(prwlock_t *lock) {
+  check(pthread_mutex_destroy(&lock->mutex), "Destroying reader-writer lock");
+  check(pthread_cond_destroy(&lock->cond), "Destroying reader-writer lock");
+}
+
+void prwlock_read_lock(prwlock_t *lock) {
+  if (!try_read(lock)) {
+    sleep_until(lock, try_read);
+  }
+}
+
+void prwlock_read_unlock(prwlock_t *lock) {
+  unsigned int state = atomic_fetch_sub(&lock->state, READER) - READER;
+
+  // Only a writer can be waiting for the last reader to leave.
+  if ((state & READERS) == 0 && (state & WRITERS_WAIT)) {
+    wake(lock);
+  }
+}
+
+void prwlock_write_lock(prwlock_t *lock) {
+  // From here on no new reader gets in.
+  atomic_fetch_add(&lock->state, WRITER_WAITS);
+
+  if (!try_write(lock)) {
+    sleep_until(lock, try_write);
+  }
+}
+
+void prwlock_write_unlock(prwlock_t *lock) {
+  atomic_fetch_and(&lock->state, ~WRITER);
+  wake(lock);
+}
+
+unsigned int prwlock_readers(prwlock_t *lock) {
+  return atomic_load(&lock->state) & READERS;
+}
+
+unsigned int prwlock_writers_waiting(prwlock_t *lock) {
+  return (atomic_load(&lock->state) & WRITERS_WAIT) / WRITER_WAITS;
+}
+
+/*******************************************************************************
+                                 Ticket lock
+********************************************************************************/
+
+/* A waiter pauses between looks at serving and yields the processor once
+   every TICKET_SPIN looks, so that a preempted holder gets to run. */
+#define TICKET_SPIN 100
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+pticket_t *pticket_init(void) {
+  pticket_t *lock = aligned_alloc(PTICKET_LINE_SIZE, sizeof(pticket_t));
+
+  if (lock == NULL) {
+    perror("Initializing new ticket lock");
+    abort();
+  }
+
+  pticket_init_at(lock);
+  return lock;
+}
+
+void pticket_init_at(pticket_t *lock) {
+  atomic_init(&lock->next, 0);
+  atomic_init(&lock->serving, 0);
+}
+
+void pticket_destroy(pticket_t *lock) {
+  pticket_fini(lock);
+  free(lock);
+}
+
+void pticket_fini(pticket_t *lock) {
+  (void) lock;
+}
+
+void pticket_lock(pticket_t *lock) {
+  unsigned int ticket = atomic_fetch_add_explicit(&lock->next, 1, memory_order_relaxed);
+  int spins = 0;
+
+  while (atomic_load_explicit(&lock->serving, memory_order_acquire) != ticket) {
+    cpu_relax();
+    if (++spins % TICKET_SPIN == 0) {
+      sched_yield();
+    }
+  }
+}
+
+void pticket_unlock(pticket_t *lock) {
+  // Only the holder writes serving.
+  unsigned int serving = atomic_load_explicit(&lock->serving, memory_order_relaxed);
+
+  atomic_store_explicit(&lock->serving, serving + 1, memory_order_release);
+}
@@ -0,0 +1,124 @@
+/*
+  Locks to go with the semaphores of psem.h, for critical sections a psem_t
+  used as a mutex serves poorly.
+
+  A reader-writer lock lets any number of readers in at the same time, so
+  read-mostly data is no longer reached one thread at a time. A ticket lock
+  hands a contended lock to its waiters in the order they arrived.
+
+  As with psem.h, on error all functions print an error message and terminate
+  the program.
+*/
+
+#ifndef PLOCK_H
+#define PLOCK_H
+
+#include <stdatomic.h> // atomic_uint
+#include <pthread.h>   // pthread_mutex_t, pthread_cond_t
+
+/*******************************************************************************
+                              Reader-writer lock
+********************************************************************************/
+
+/* Readers, writers and waiting writers are counted in a single word, see
+   plock.c. Threads that cannot take the lock sleep on cond. */
+typedef struct {
+  atomic_uint     state;
+  atomic_uint     sleepers;
+  pthread_mutex_t mutex;
+  pthread_cond_t  cond;
+} prwlock_t;
+
+#define PRWLOCK_INITIALIZER { 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER }
+
+/* prwlock_init()
+   prwlock_init_at(lock)
+
+   Initializes a new reader-writer lock, or one in storage provided by the
+   caller, unlocked. As for semaphores, a lock from prwlock_init() is freed by
+   prwlock_destroy() and one from prwlock_init_at() or PRWLOCK_INITIALIZER is
+   finalized by prwlock_fini().
+*/
+prwlock_t *prwlock_init(void);
+void prwlock_init_at(prwlock_t *lock);
+void prwlock_destroy(prwlock_t *lock);
+void prwlock_fini(prwlock_t *lock);
+
+/* prwlock_read_lock(lock)
+   prwlock_read_unlock(lock)
+
+   Take and release the lock for reading, shared with other readers.
+
+   The lock prefers writers. A reader waits while a writer holds the lock or
+   waits for it, so a steady stream of readers cannot keep a writer out, but
+   a steady stream of writers keeps readers out. A thread holding the lock for
+   reading must not take it for reading again, as a writer waiting in between
+   would wait for the first hold while the second waits for the writer.
+*/
+void prwlock_read_lock(prwlock_t *lock);
+void prwlock_read_unlock(prwlock_t *lock);
+
+/* prwlock_write_lock(lock)
+   prwlock_write_unlock(lock)
+
+   Take and release the lock for writing, excluding all other readers and
+   writers.
+*/
+void prwlock_write_lock(prwlock_t *lock);
+void prwlock_write_unlock(prwlock_t *lock);
+
+/* prwlock_readers(lock)
+   prwlock_writers_waiting(lock)
+
+   Return value
+
+   The number of readers holding the lock, and the number of writers waiting
+   for it. A snapshot that may be out of date as soon as it is returned, for
+   tests and statistics.
+*/
+unsigned int prwlock_readers(prwlock_t *lock);
+unsigned int prwlock_writers_waiting(prwlock_t *lock);
+
+/*******************************************************************************
+                                 Ticket lock
+********************************************************************************/
+
+/* A thread draws a ticket from next and holds the lock once serving has
+   reached its ticket. The two counters are on separate cache lines, so that
+   drawing tickets does not disturb the waiters watching serving. */
+#define PTICKET_LINE_SIZE 64
+
+typedef struct {
+  _Alignas(PTICKET_LINE_SIZE) atomic_uint next;
+  _Alignas(PTICKET_LINE_SIZE) atomic_uint serving;
+} pticket_t;
+
+#define PTICKET_INITIALIZER { 0, 0 }
+
+/* pticket_init()
+   pticket_init_at(lock)
+
+   Initializes a new ticket lock, or one in storage provided by the caller,
+   unlocked. Freed by pticket_destroy() and finalized by pticket_fini()
+   respectively, as for prwlock_init() and prwlock_init_at().
+*/
+pticket_t *pticket_init(void);
+void pticket_init_at(pticket_t *lock);
+void pticket_destroy(pticket_t *lock);
+void pticket_fini(pticket_t *lock);
+
+/* pticket_lock(lock)
+   pticket_unlock(lock)
+
+   Take and release the lock. Threads take a contended lock strictly in the
+   order they called pticket_lock().
+
+   Waiters spin, yielding the processor after a while, rather than sleep in
+   the kernel. The lock suits short critical sections with no more threads
+   than processors. With more, the thread next in line may not be running
+   when the lock is handed to it and everyone behind it has to wait.
+*/
+void pticket_lock(pticket_t *lock);
+void pticket_unlock(pticket_t *lock);
+
+#endif
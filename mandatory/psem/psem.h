@@ -15,9 +15,16 @@
   First version by Karl Marklund <karl.marklund@it.uu.se>.
 */
 
+#ifndef PSEM_H
+#define PSEM_H
+
 /* Platform dependent definition of the psem_t data type. */
 #include "platform_specifics.h"
 
+#include <stdbool.h> // bool
+#include <stdio.h>   // FILE
+#include <time.h>    // struct timespec
+
 /*******************************************************************************
                                  Semaphore API
 ********************************************************************************/
@@ -33,6 +40,28 @@
 */
 psem_t *psem_init(unsigned int value);
 
+/* psem_init_at(sem, value)
+
+   Initializes a semaphore in storage provided by the caller, with semaphore
+   counter set to value. This lets a semaphore live inside the structure it
+   guards instead of in a separate allocation. A semaphore initialized by
+   psem_init_at() is finalized with psem_fini(), not psem_destroy().
+
+   A semaphore with static storage duration can instead be initialized with
+
+     psem_t sem = PSEM_INITIALIZER(value);
+*/
+void psem_init_at(psem_t *sem, unsigned int value);
+
+/* psem_init_shared_at(sem, value)
+
+   Like psem_init_at() but for a semaphore in memory shared between processes,
+   such as a mapping of a shm_open() object, which may be waited on and
+   signaled from all processes mapping it. Finalized with psem_fini(). Not
+   supported on macOS, where the program is terminated.
+*/
+void psem_init_shared_at(psem_t *sem, unsigned int value);
+
 /* psem_wait(sem)
 
   Atomically decrements the counter of the semaphore pointed to by sem. If the
@@ -43,6 +72,22 @@ psem_t *psem_init(unsigned int value);
 */
 void psem_wait(psem_t *sem);
 
+/* psem_trywait(sem)
+
+  Like psem_wait() but never blocks. If the semaphore's counter value is
+  greater than zero it is decremented and true is returned, otherwise the
+  counter is left unchanged and false is returned.
+*/
+bool psem_trywait(psem_t *sem);
+
+/* psem_timedwait(sem, abstime)
+
+  Like psem_wait() but gives up when the absolute time abstime, measured
+  against CLOCK_REALTIME, has passed without the counter being decremented.
+  Returns true if the counter was decremented and false on timeout.
+*/
+bool psem_timedwait(psem_t *sem, const struct timespec *abstime);
+
 /* psem_signal(sem)
 
    Atomically increments the counter of the semaphore pointed to by sem.  If
@@ -52,9 +97,168 @@ void psem_wait(psem_t *sem);
 */
 void psem_signal(psem_t *sem);
 
+/* psem_wait_n(sem, n)
+
+  Atomically decrements the counter of the semaphore pointed to by sem by n,
+  blocking until the counter is at least n. Units are never taken one at a
+  time, so two threads each waiting for n units cannot each end up holding
+  some of them.
+*/
+void psem_wait_n(psem_t *sem, unsigned int n);
+
+/* psem_signal_n(sem, n)
+
+   Atomically increments the counter of the semaphore pointed to by sem by n
+   and wakes up as many blocked threads as the n units may let proceed, at
+   the cost of a single psem_signal().
+*/
+void psem_signal_n(psem_t *sem, unsigned int n);
+
 /* psem_destroy(sem)
 
    Destroys the semaphore pointed to by sem. Only a semaphore that has been
    initialized by psem_init() should be destroyed using psem_destroy().
  */
 void psem_destroy(psem_t *sem);
+
+/* psem_fini(sem)
+
+   Releases the resources of a semaphore initialized by psem_init_at() or
+   PSEM_INITIALIZER, leaving its storage to the caller. The other _fini
+   functions of the library, such as pevent_fini() and pticket_fini(), do the
+   same for their types, and may have nothing to release on some platforms.
+ */
+void psem_fini(psem_t *sem);
+
+/*******************************************************************************
+                                 Eventcount API
+********************************************************************************/
+
+/* An eventcount lets threads wait for a condition on data they read and
+   write without locks, such as a lock-free queue being non-empty, and lets
+   the threads changing the data skip waking anyone when nobody waits.
+
+   A waiter announces itself, checks the condition and only then blocks:
+
+     while (!condition()) {
+       unsigned int key = pevent_prepare_wait(&ev);
+
+       if (condition()) {
+         pevent_cancel_wait(&ev);
+         break;
+       }
+       pevent_commit_wait(&ev, key);
+     }
+
+   A notifier makes the condition true and then calls pevent_notify() or
+   pevent_notify_all(), which advance the epoch of the eventcount. A waiter
+   blocks only as long as the epoch is still its key. Either the waiter sees
+   the condition or the notifier sees the waiter, so no wake-up is lost, and a
+   notifier that finds no waiter returns without a system call.
+
+   The pevent_t type is platform dependent, see platform_specifics.h. */
+
+/* pevent_init_at(ev)
+   pevent_init_shared_at(ev)
+
+   Initialize an eventcount without waiters in storage provided by the caller,
+   private to the process or in memory shared between processes as for
+   psem_init_shared_at(). Finalized with pevent_fini(). An eventcount with
+   static storage duration can instead be initialized with
+
+     pevent_t ev = PEVENT_INITIALIZER;
+*/
+void pevent_init_at(pevent_t *ev);
+void pevent_init_shared_at(pevent_t *ev);
+void pevent_fini(pevent_t *ev);
+
+/* pevent_prepare_wait(ev)
+
+   Counts the calling thread as a waiter. Must be followed by a check of the
+   condition and then by pevent_cancel_wait() or pevent_commit_wait().
+
+   Return value
+
+   The key to pass to pevent_commit_wait().
+*/
+unsigned int pevent_prepare_wait(pevent_t *ev);
+
+/* pevent_cancel_wait(ev)
+
+   Stops waiting after pevent_prepare_wait(), as the condition already holds.
+*/
+void pevent_cancel_wait(pevent_t *ev);
+
+/* pevent_commit_wait(ev, key)
+
+   Blocks after pevent_prepare_wait() until a notifier has advanced the epoch
+   past key, which may already have happened. The caller then checks the
+   condition again.
+*/
+void pevent_commit_wait(pevent_t *ev, unsigned int key);
+
+/* pevent_commit_timedwait(ev, key, abstime)
+
+   Like pevent_commit_wait() but stops waiting when the absolute time abstime,
+   measured against CLOCK_REALTIME, has passed. Returns false on timeout.
+*/
+bool pevent_commit_timedwait(pevent_t *ev, unsigned int key, const struct timespec *abstime);
+
+/* pevent_notify(ev)
+   pevent_notify_all(ev)
+
+   Wake one or all blocked waiters, if any. Called after making the condition
+   true. All waiters between pevent_prepare_wait() and blocking see the new
+   epoch and do not block.
+*/
+void pevent_notify(pevent_t *ev);
+void pevent_notify_all(pevent_t *ev);
+
+/*******************************************************************************
+                                  Tracing API
+********************************************************************************/
+
+/* Built with PSEM_TRACE defined (make TRACE=y), every semaphore records how
+   many waits it has seen, counting every successful psem_trywait() as a wait
+   that did not block, how many of them blocked, the total and longest time
+   blocked and a log2 histogram of blocked times, measured with the timing.h
+   clock. A program built this way must also link timing.o.
+
+   Semaphores are listed from their first wait until they are finalized.
+   Process-shared semaphores keep their counts but are never listed, as the
+   list is private to each process.
+
+   Without PSEM_TRACE the functions below are empty macros and the semaphore
+   operations are not instrumented at all. */
+
+#ifdef PSEM_TRACE
+
+/* psem_trace_name(sem, name)
+
+   Names the semaphore in the output of psem_trace_print() and
+   psem_trace_csv(). The name is not copied.
+*/
+void psem_trace_name(psem_t *sem, const char *name);
+
+/* psem_trace_print()
+
+   Prints the statistics of all listed semaphores to stdout.
+*/
+void psem_trace_print(void);
+
+/* psem_trace_csv(out)
+
+   Writes the statistics of all listed semaphores to out as comma separated
+   values, one line per semaphore after a header line.
+*/
+void psem_trace_csv(FILE *out);
+
+#else
+
+#define psem_trace_name(sem, name) ((void) 0)
+#define psem_trace_print() ((void) 0)
+#define psem_trace_csv(out) ((void) 0)
+
+#endif
+
+#endif
@@ -0,0 +1,157 @@
+#include <stdio.h>   // printf(), fprintf()
+#include <string.h>  // memset()
+#include <pthread.h> // pthread_mutex_lock(), pthread_mutex_unlock()
+
+#include "psem.h"
+#include "psem_trace.h"
+
+/*
+  Statistics are updated with relaxed atomics on the semaphore itself. The
+  list of traced semaphores is only taken on the first wait on a semaphore,
+  when it is finalized and when the statistics are printed.
+*/
+
+static pthread_mutex_t list_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct psem_trace *list = NULL;
+
+void psem_trace_init(psem_t *sem, bool shared) {
+  memset(&sem->trace, 0, sizeof(sem->trace));
+  sem->trace.shared = shared;
+}
+
+void psem_trace_fini(psem_t *sem) {
+  struct psem_trace *trace = &sem->trace;
+
+  if (!atomic_load(&trace->listed)) {
+    return;
+  }
+
+  pthread_mutex_lock(&list_lock);
+
+  for (struct psem_trace **p = &list; *p != NULL; p = &(*p)->next) {
+    if (*p == trace) {
+      *p = trace->next;
+      break;
+    }
+  }
+  atomic_store(&trace->listed, false);
+
+  pthread_mutex_unlock(&list_lock);
+}
+
+void psem_trace_name(psem_t *sem, const char *name) {
+  sem->trace.name = name;
+}
+
+static void list_add(struct psem_trace *trace) {
+  if (trace->shared || atomic_exchange(&trace->listed, true)) {
+    return;
+  }
+
+  pthread_mutex_lock(&list_lock);
+  trace->next = list;
+  list = trace;
+  pthread_mutex_unlock(&list_lock);
+}
+
+/* Histogram bucket of a wait that blocked for ns nanoseconds. */
+static int bucket(unsigned long long ns) {
+  int i = 0;
+
+  while (i < PSEM_TRACE_BUCKETS - 1 && (ns >> (i + 1)) != 0) {
+    i++;
+  }
+  return i;
+}
+
+void psem_trace_wait(psem_t *sem, struct timespec *since) {
+  struct psem_trace *trace = &sem->trace;
+
+  if (!atomic_load_explicit(&trace->listed, memory_order_relaxed)) {
+    list_add(trace);
+  }
+
+  atomic_fetch_add_explicit(&trace->waits, 1, memory_order_relaxed);
+
+  if (since == NULL) {
+    return;
+  }
+
+  unsigned long long ns = timing_stop(since) * 1E9;
+  unsigned long long max = atomic_load_explicit(&trace->max_ns, memory_order_relaxed);
+
+  atomic_fetch_add_explicit(&trace->blocked, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&trace->blocked_ns, ns, memory_order_relaxed);
+  atomic_fetch_add_explicit(&trace->histogram[bucket(ns)], 1, memory_order_relaxed);
+
+  while (ns > max &&
+         !atomic_compare_exchange_weak_explicit(&trace->max_ns, &max, ns,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed));
+}
+
+/* Shortest blocked time counted in bucket i. */
+static unsigned long long low(int i) {
+  return (i == 0) ? 0 : 1ULL << i;
+}
+
+#define LOAD(field) atomic_load_explicit(&(field), memory_order_relaxed)
+
+void psem_trace_print(void) {
+  pthread_mutex_lock(&list_lock);
+
+  puts("");
+  puts("---- Semaphore Trace ----");
+
+  for (struct psem_trace *t = list; t != NULL; t = t->next) {
+    unsigned long long blocked = LOAD(t->blocked);
+
+    printf("\n%s (%p)\n", (t->name != NULL) ? t->name : "semaphore", (void *) t);
+    printf("       waits: %llu\n", LOAD(t->waits));
+    printf("     blocked: %llu\n", blocked);
+
+    if (blocked == 0) continue;
+
+    printf("  time total: %.6f s\n", LOAD(t->blocked_ns) * 1E-9);
+    printf("        mean: %.3f us\n", LOAD(t->blocked_ns) * 1E-3 / blocked);
+    printf("         max: %.3f us\n", LOAD(t->max_ns) * 1E-3);
+
+    for (int i = 0; i < PSEM_TRACE_BUCKETS; i++) {
+      unsigned long long n = LOAD(t->histogram[i]);
+
+      if (n == 0) continue;
+
+      printf("  %12llu ns: %10llu (%5.1f%%)\n", low(i), n, 100.0 * n / blocked);
+    }
+  }
+
+  puts("");
+  puts("-------------------------");
+  puts("");
+
+  pthread_mutex_unlock(&list_lock);
+}
+
+void psem_trace_csv(FILE *out) {
+  pthread_mutex_lock(&list_lock);
+
+  fprintf(out, "name,address,waits,blocked,blocked_ns,max_ns");
+
+  for (int i = 0; i < PSEM_TRACE_BUCKETS; i++) {
+    fprintf(out, ",ge_%llu_ns", low(i));
+  }
+  fprintf(out, "\n");
+
+  for (struct psem_trace *t = list; t != NULL; t = t->next) {
+    fprintf(out, "%s,%p,%llu,%llu,%llu,%llu",
+            (t->name != NULL) ? t->name : "semaphore", (void *) t,
+            LOAD(t->waits), LOAD(t->blocked), LOAD(t->blocked_ns), LOAD(t->max_ns));
+
+    for (int i = 0; i < PSEM_TRACE_BUCKETS; i++) {
+      fprintf(out, ",%llu", LOAD(t->histogram[i]));
+    }
+    fprintf(out, "\n");
+  }
+
+  pthread_mutex_unlock(&list_lock);
+}
@@ -0,0 +1,20 @@
+/*
+  Hooks through which the semaphore implementations feed the statistics of
+  PSEM_TRACE builds, see psem_trace.c.
+*/
+
+#ifdef PSEM_TRACE
+
+#include "timing.h" // timing_start(), timing_stop()
+
+/* Clears the statistics of sem. */
+void psem_trace_init(psem_t *sem, bool shared);
+
+/* Takes sem off the list of traced semaphores. */
+void psem_trace_fini(psem_t *sem);
+
+/* Records a wait on sem, which blocked from since unless since is NULL. Also
+   called for every successful psem_trywait(), with since NULL. */
+void psem_trace_wait(psem_t *sem, struct timespec *since);
+
+#endif
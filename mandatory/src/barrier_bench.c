@@ -0,0 +1,217 @@
+/**
+ * Barrier benchmark.
+ *
+ * Threads run a number of empty phases separated by a barrier, for thread
+ * counts from 2 up to a maximum, and the time per phase is reported for
+ *
+ *   psem   - the reusable two-turnstile barrier built from semaphores as in
+ *            the rendezvous exercise,
+ *   spin   - the sense-reversing spinning pbarrier_t,
+ *   block  - the blocking pbarrier_t,
+ *   tree   - the spinning pbarrier_tree_t,
+ *   tblock - the blocking pbarrier_tree_t.
+ */
+
+#include <stdio.h>   // printf(), fprintf()
+#include <stdlib.h>  // exit(), atoi()
+#include <stdbool.h> // bool
+#include <unistd.h>  // getopt()
+#include <pthread.h> // pthread_...
+#include <stdint.h>  // intptr_t
+
+#include "psem.h"
+#include "pbarrier.h"
+#include "timing.h"  // timing_start(), timing_stop()
+
+#define MAX_THREADS 128
+#define THREADS     64
+#define PHASES      1000
+#define FANOUT      4
+
+typedef enum { PSEM, SPIN, BLOCK, TREE, TREE_BLOCK } barrier_kind_t;
+
+const char *barrier_names[] = { "psem", "spin", "block", "tree", "tblock" };
+
+/* Reusable barrier from a mutex and two turnstiles. All threads pass the
+   first turnstile once the last has arrived, and the second once the last
+   has left the first, so that no thread laps the others. */
+typedef struct {
+  unsigned int n;
+  unsigned int count;
+  psem_t mutex;
+  psem_t turnstile1;
+  psem_t turnstile2;
+} sem_barrier_t;
+
+void sem_barrier_init(sem_barrier_t *barrier, unsigned int n) {
+  barrier->n = n;
+  barrier->count = 0;
+  psem_init_at(&barrier->mutex, 1);
+  psem_init_at(&barrier->turnstile1, 0);
+  psem_init_at(&barrier->turnstile2, 0);
+}
+
+void sem_barrier_fini(sem_barrier_t *barrier) {
+  psem_fini(&barrier->mutex);
+  psem_fini(&barrier->turnstile1);
+  psem_fini(&barrier->turnstile2);
+}
+
+void sem_barrier_wait(sem_barrier_t *barrier) {
+  psem_wait(&barrier->mutex);
+  if (++barrier->count == barrier->n) {
+    psem_signal_n(&barrier->turnstile1, barrier->n);
+  }
+  psem_signal(&barrier->mutex);
+  psem_wait(&barrier->turnstile1);
+
+  psem_wait(&barrier->mutex);
+  if (--barrier->count == 0) {
+    psem_signal_n(&barrier->turnstile2, barrier->n);
+  }
+  psem_signal(&barrier->mutex);
+  psem_wait(&barrier->turnstile2);
+}
+
+barrier_kind_t  kind;
+sem_barrier_t   sem_barrier;
+pbarrier_t      barrier;
+pbarrier_tree_t tree_barrier;
+
+int  nthreads;
+int  fanout;
+int  phases;
+bool check;
+
+/* The phase each thread has reached, with check. */
+atomic_int reached[MAX_THREADS];
+
+void barrier_wait(int id) {
+  switch (kind) {
+  case PSEM:       sem_barrier_wait(&sem_barrier); break;
+  case SPIN:
+  case BLOCK:      pbarrier_wait(&barrier); break;
+  case TREE:
+  case TREE_BLOCK: pbarrier_tree_wait(&tree_barrier, id); break;
+  }
+}
+
+void *phase_thread(void *arg) {
+  int id = (int) (intptr_t) arg;
+
+  for (int p = 0; p < phases; p++) {
+    if (check) {
+      atomic_store(&reached[id], p + 1);
+    }
+
+    barrier_wait(id);
+
+    // No thread gets past the barrier before all threads have reached it.
+    if (check) {
+      for (int i = 0; i < nthreads; i++) {
+        if (atomic_load(&reached[i]) < p + 1) {
+          fprintf(stderr, "Thread %d left phase %d before thread %d reached it\n", id, p, i);
+          abort();
+        }
+      }
+    }
+  }
+  pthread_exit(NULL);
+}
+
+/* Runs the phases with n threads, returning the time per phase in seconds. */
+double run(barrier_kind_t k, int n) {
+  pthread_t tid[MAX_THREADS];
+  struct timespec start;
+
+  kind = k;
+  nthreads = n;
+
+  switch (kind) {
+  case PSEM:       sem_barrier_init(&sem_barrier, n); break;
+  case SPIN:       pbarrier_init_spin_at(&barrier, n); break;
+  case BLOCK:      pbarrier_init_at(&barrier, n); break;
+  case TREE:       pbarrier_tree_init_spin_at(&tree_barrier, n, fanout); break;
+  case TREE_BLOCK: pbarrier_tree_init_at(&tree_barrier, n, fanout); break;
+  }
+
+  for (int i = 0; i < n; i++) {
+    atomic_store(&reached[i], 0);
+  }
+
+  timing_start(&start);
+
+  for (int i = 0; i < n; i++) {
+    if (pthread_create(&tid[i], NULL, phase_thread, (void *) (intptr_t) i) != 0) {
+      perror("pthread_create");
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (int i = 0; i < n; i++) {
+    pthread_join(tid[i], NULL);
+  }
+
+  double time = timing_stop(&start);
+
+  switch (kind) {
+  case PSEM:       sem_barrier_fini(&sem_barrier); break;
+  case SPIN:
+  case BLOCK:      pbarrier_fini(&barrier); break;
+  case TREE:
+  case TREE_BLOCK: pbarrier_tree_fini(&tree_barrier); break;
+  }
+
+  return time / phases;
+}
+
+void usage(char *argv[]) {
+  fprintf(stderr, "Usage: %s [-t max_threads] [-n phases] [-f fanout] [-c]\n\n", argv[0]);
+  fprintf(stderr, "  -t  Largest number of threads, up to %d (default %d).\n", MAX_THREADS, THREADS);
+  fprintf(stderr, "  -n  Phases per run (default %d).\n", PHASES);
+  fprintf(stderr, "  -f  Fanout of the tree barriers (default %d).\n", FANOUT);
+  fprintf(stderr, "  -c  Check that no thread leaves a phase early.\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+  int max_threads = THREADS;
+  int opt;
+
+  phases = PHASES;
+  fanout = FANOUT;
+  setbuf(stdout, NULL);
+
+  while ((opt = getopt(argc, argv, "t:n:f:c")) != -1) {
+    switch (opt) {
+    case 't': max_threads = atoi(optarg); break;
+    case 'n': phases = atoi(optarg); break;
+    case 'f': fanout = atoi(optarg); break;
+    case 'c': check = true; break;
+    default:  usage(argv);
+    }
+  }
+
+  if (max_threads < 2 || max_threads > MAX_THREADS || phases < 1 || fanout < 2) {
+    usage(argv);
+  }
+
+  printf("\n%d phases per run, tree fanout %d (us/phase)\n\n", phases, fanout);
+  printf("%8s", "threads");
+
+  for (barrier_kind_t k = PSEM; k <= TREE_BLOCK; k++) {
+    printf("  %10s", barrier_names[k]);
+  }
+  printf("\n");
+
+  // Double the threads, ending with max_threads.
+  for (int n = 2; n <= max_threads; n = (n < max_threads && 2*n > max_threads) ? max_threads : 2*n) {
+    printf("%8d", n);
+
+    for (barrier_kind_t k = PSEM; k <= TREE_BLOCK; k++) {
+      printf("  %10.2f", 1e6 * run(k, n));
+    }
+    printf("\n");
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -9,36 +9,545 @@
 #include <stdlib.h>         // [s]rand()
 #include <unistd.h>         // usleep(), sleep()
 #include <pthread.h>        // pthread_...
+#include <sched.h>          // sched_yield()
+#include <time.h>           // clock_gettime()
+#include <stdint.h>         // uintptr_t
+#include <fcntl.h>          // O_CREAT, O_EXCL, O_RDWR
+#include <sys/mman.h>       // shm_open(), shm_unlink(), mmap(), munmap()
+#include <sys/stat.h>       // fstat()
+
+#include "timing.h"         // timing_start(), timing_stop()
+
+/* Number of busy-wait iterations before a lock-free operation on a full or
+   empty buffer starts yielding the CPU. */
+#define SPIN_LIMIT 128
+
+/* Bit set in head when a BUFFER_MPMC buffer is closed. */
+#define HEAD_CLOSED ((size_t) 1 << (sizeof(size_t)*8 - 1))
+
+/* Tell the CPU we are busy-waiting, lowering power use and the penalty of
+   leaving the spin loop. */
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+/* Back off while waiting for the other side of a lock-free buffer. Spin for a
+   while, then give the CPU away so that the other side can make progress even
+   when both run on the same core. */
+static void backoff(int *spins) {
+  if (*spins < SPIN_LIMIT) {
+    cpu_relax();
+    (*spins)++;
+  } else {
+    sched_yield();
+  }
+}
+
+/* Deadline telling an operation not to wait at all. A NULL deadline tells an
+   operation to wait for as long as it takes. */
+static const struct timespec no_wait;
+
+/* True if the absolute CLOCK_REALTIME time deadline has passed. */
+static bool expired(const struct timespec *deadline) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  return now.tv_sec > deadline->tv_sec ||
+    (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec);
+}
+
+/* Like backoff() but returns false instead when deadline does not allow any
+   more waiting. */
+static bool backoff_until(int *spins, const struct timespec *deadline) {
+  if (deadline == &no_wait || (deadline != NULL && expired(deadline))) {
+    return false;
+  }
+  backoff(spins);
+  return true;
+}
+
+/* Take one unit from sem, waiting no longer than deadline allows. */
+static bool acquire(psem_t *sem, const struct timespec *deadline) {
+  if (deadline == NULL) {
+    psem_wait(sem);
+    return true;
+  }
+  if (deadline == &no_wait) {
+    return psem_trywait(sem);
+  }
+  return psem_timedwait(sem, deadline);
+}
+
+/*******************************************************************************
+                          Adaptive spin-then-park waiting
+********************************************************************************/
+
+/* With BUFFER_ADAPTIVE a thread that finds the buffer full or empty first
+   spins for up to budget iterations, and only parks on a semaphore if the
+   buffer is still full or empty after that. Each side of the buffer keeps its
+   own budget: a wait that ends while spinning grows the budget, a wait that
+   has to park shrinks it. */
+
+/* Smallest spin budget, so that a side that had to park keeps probing. */
+#define SPIN_BUDGET_MIN 16
+
+/* Initial and default largest spin budget, see buffer_set_spin_max(). */
+#define SPIN_BUDGET_INIT 256
+#define SPIN_BUDGET_MAX  4096
+
+static void spin_succeeded(buffer_t *buffer, waiter_t *w) {
+  int budget = atomic_load_explicit(&w->budget, memory_order_relaxed);
+
+  budget += budget / 2 + 1;
+  if (budget > buffer->spin_max) budget = buffer->spin_max;
+
+  atomic_store_explicit(&w->budget, budget, memory_order_relaxed);
+  atomic_fetch_add_explicit(&w->spins, 1, memory_order_relaxed);
+}
+
+static void spin_failed(waiter_t *w) {
+  int budget = atomic_load_explicit(&w->budget, memory_order_relaxed);
+
+  budget /= 2;
+  if (budget < SPIN_BUDGET_MIN) budget = SPIN_BUDGET_MIN;
+
+  atomic_store_explicit(&w->budget, budget, memory_order_relaxed);
+  atomic_fetch_add_explicit(&w->parks, 1, memory_order_relaxed);
+}
+
+/* Take one unit from sem, spinning before parking when the buffer is
+   adaptive. */
+static bool wait_adaptive(buffer_t *buffer, waiter_t *w, psem_t *sem,
+                          const struct timespec *deadline) {
+  if (!(buffer->flags & BUFFER_ADAPTIVE)) {
+    return acquire(sem, deadline);
+  }
+
+  if (psem_trywait(sem)) {
+    return true;
+  }
+
+  if (deadline == &no_wait) {
+    return false;
+  }
+
+  int budget = atomic_load_explicit(&w->budget, memory_order_relaxed);
+
+  for (int i = 0; i < budget; i++) {
+    cpu_relax();
+    if (psem_trywait(sem)) {
+      spin_succeeded(buffer, w);
+      return true;
+    }
+  }
+
+  spin_failed(w);
+  return acquire(sem, deadline);
+}
+
+/*******************************************************************************
+                                   Statistics
+********************************************************************************/
+
+/* With BUFFER_STATS every thread using the buffer updates a block of counters
+   of its own, found through a thread-specific key. A block has a single
+   writer, so counters are bumped with plain relaxed loads and stores instead
+   of atomic read-modify-write, and blocks start on separate cache lines.
+   buffer_stats() merges all blocks. Blocks are never unlinked, so the
+   counters of threads that have exited are kept. */
+
+struct buffer_stats_block {
+  atomic_size_t puts;
+  atomic_size_t gets;
+  atomic_size_t full_waits;
+  atomic_size_t empty_waits;
+  atomic_size_t full_ns;
+  atomic_size_t empty_ns;
+  atomic_size_t contended;
+  atomic_size_t high_water;
+  atomic_size_t occupancy[BUFFER_STATS_BUCKETS];
+  struct buffer_stats_block *next;
+};
+
+static inline void bump(atomic_size_t *counter, size_t n) {
+  size_t value = atomic_load_explicit(counter, memory_order_relaxed);
+  atomic_store_explicit(counter, value + n, memory_order_relaxed);
+}
+
+/* The calling thread's counters for buffer, created on first use. */
+static struct buffer_stats_block *stats_block(buffer_t *buffer) {
+  struct buffer_stats_block *block = pthread_getspecific(buffer->stats_key);
+
+  if (block != NULL) {
+    return block;
+  }
+
+  size_t bytes = (sizeof(*block) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+  block = aligned_alloc(CACHE_LINE_SIZE, bytes);
+
+  if (block == NULL) {
+    perror("Could not allocate buffer statistics");
+    exit(EXIT_FAILURE);
+  }
+  memset(block, 0, bytes);
+
+  // Push the block onto the buffer's list of blocks.
+  block->next = atomic_load(&buffer->stats);
+  while (!atomic_compare_exchange_weak(&buffer->stats, &block->next, block))
+    ;
+
+  if (pthread_setspecific(buffer->stats_key, block) != 0) {
+    perror("pthread_setspecific()");
+    abort();
+  }
+  return block;
+}
+
+/* Count n puts or gets and sample the occupancy of the buffer. */
+static void stats_moved(buffer_t *buffer, bool put, size_t n) {
+  if (!(buffer->flags & BUFFER_STATS)) {
+    return;
+  }
+
+  struct buffer_stats_block *block = stats_block(buffer);
+
+  bump(put ? &block->puts : &block->gets, n);
+
+  // Head and tail are read without synchronization, the sample is approximate.
+  size_t head = atomic_load_explicit(&buffer->head, memory_order_relaxed) & ~HEAD_CLOSED;
+  size_t tail = atomic_load_explicit(&buffer->tail, memory_order_relaxed);
+  size_t occupancy = (head > tail) ? head - tail : 0;
+
+  if (occupancy > (size_t) buffer->size) {
+    occupancy = buffer->size;
+  }
+
+  if (occupancy > atomic_load_explicit(&block->high_water, memory_order_relaxed)) {
+    atomic_store_explicit(&block->high_water, occupancy, memory_order_relaxed);
+  }
+
+  size_t bucket = occupancy * BUFFER_STATS_BUCKETS / (buffer->size + 1);
+  bump(&block->occupancy[bucket], 1);
+}
+
+/* Count a wait of seconds on a full (put) or empty (get) buffer. */
+static void stats_waited(buffer_t *buffer, bool put, double seconds) {
+  struct buffer_stats_block *block = stats_block(buffer);
+
+  bump(put ? &block->full_waits : &block->empty_waits, 1);
+  bump(put ? &block->full_ns : &block->empty_ns, (size_t) (seconds * 1E9));
+}
+
+/* Take the buffer's mutex, waiting no longer than deadline allows and
+   counting the times it was already taken. */
+static bool lock(buffer_t *buffer, const struct timespec *deadline) {
+  if (!(buffer->flags & BUFFER_STATS)) {
+    return acquire(&buffer->mutex_sem, deadline);
+  }
+
+  if (psem_trywait(&buffer->mutex_sem)) {
+    return true;
+  }
+  bump(&stats_block(buffer)->contended, 1);
+  return acquire(&buffer->mutex_sem, deadline);
+}
+
+/* Take one unit from sem, timing the wait if the buffer keeps statistics. */
+static bool wait_on(buffer_t *buffer, waiter_t *w, psem_t *sem,
+                    const struct timespec *deadline) {
+  if (!(buffer->flags & BUFFER_STATS) || deadline == &no_wait) {
+    return wait_adaptive(buffer, w, sem, deadline);
+  }
+
+  if (psem_trywait(sem)) {
+    return true;
+  }
+
+  struct timespec start;
+  timing_start(&start);
+
+  bool ok = wait_adaptive(buffer, w, sem, deadline);
+
+  stats_waited(buffer, w == &buffer->put_wait, timing_stop(&start));
+  return ok;
+}
+
+/* A buffer in shared memory finds its slot array and sequence numbers at an
+   offset from itself rather than through a pointer, so that it works in every
+   process mapping it, at whatever address. Both lie in the same mapping as the
+   buffer. A private buffer uses its pointers. */
+
+static inline unsigned char *slots_of(buffer_t *buffer) {
+  if (!(buffer->flags & BUFFER_SHARED)) {
+    return buffer->slots;
+  }
+  return (unsigned char *) buffer + buffer->slots_offset;
+}
+
+static inline tuple_t *array_of(buffer_t *buffer) {
+  return (tuple_t *) slots_of(buffer);
+}
+
+static inline atomic_size_t *seq_of(buffer_t *buffer) {
+  if (!(buffer->flags & BUFFER_SHARED)) {
+    return buffer->seq;
+  }
+  return (atomic_size_t *) ((unsigned char *) buffer + buffer->seq_offset);
+}
+
+/* Copy n tuples into the array starting at slot i, wrapping around at most
+   once. */
+static void copy_in(buffer_t *buffer, int i, const tuple_t *tuples, int n) {
+  int first = (n < buffer->size - i) ? n : buffer->size - i;
+
+  memcpy(&array_of(buffer)[i], tuples, first*sizeof(tuple_t));
+  memcpy(&array_of(buffer)[0], tuples + first, (n - first)*sizeof(tuple_t));
+}
+
+/* Copy n tuples out of the array starting at slot i, wrapping around at most
+   once. */
+static void copy_out(buffer_t *buffer, int i, tuple_t *tuples, int n) {
+  int first = (n < buffer->size - i) ? n : buffer->size - i;
+
+  memcpy(tuples, &array_of(buffer)[i], first*sizeof(tuple_t));
+  memcpy(tuples + first, &array_of(buffer)[0], (n - first)*sizeof(tuple_t));
+}
+
+/* Take between one and n units from sem. Waits for the first unit only. */
+static int wait_up_to(buffer_t *buffer, waiter_t *w, psem_t *sem, int n) {
+  int k = 1;
+
+  wait_on(buffer, w, sem, NULL);
+
+  while (k < n && psem_trywait(sem)) {
+    k++;
+  }
+  return k;
+}
+
+/* Slot index of ticket or index i, wrapped around at the end of the array. */
+static inline size_t wrap(buffer_t *buffer, size_t i) {
+  return buffer->mask ? (i & buffer->mask) : (i % buffer->size);
+}
+
+/* Address of slot i. */
+static inline void *slot_at(buffer_t *buffer, size_t i) {
+  return slots_of(buffer) + i*buffer->stride;
+}
+
+/* Index of the slot at address slot. */
+static inline size_t slot_index(buffer_t *buffer, const void *slot) {
+  return ((const unsigned char *) slot - slots_of(buffer)) / buffer->stride;
+}
+
+/* Distance between consecutive slots for elements of elem_size bytes aligned
+   to align bytes. Slots smaller than a cache line are rounded up to a power of
+   two so that no element straddles two cache lines, larger slots to a whole
+   number of cache lines. */
+static size_t slot_stride(size_t elem_size, size_t align) {
+  size_t stride = (elem_size + align - 1) / align * align;
+
+  if (stride >= CACHE_LINE_SIZE) {
+    return (stride + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+  }
+
+  size_t pow2 = 1;
+  while (pow2 < stride) pow2 <<= 1;
+  return pow2;
+}
+
+static void waiter_init(waiter_t *w) {
+  atomic_init(&w->budget, SPIN_BUDGET_INIT);
+  atomic_init(&w->spins, 0);
+  atomic_init(&w->parks, 0);
+}
 
 void buffer_init(buffer_t *buffer, int size) {
+  buffer_init_flags(buffer, size, 0);
+}
+
+void buffer_init_flags(buffer_t *buffer, int size, int flags) {
+  buffer_init_elem(buffer, size, sizeof(tuple_t), _Alignof(tuple_t), flags);
+}
+
+/* Capacity and slot layout of a buffer. */
+typedef struct {
+  int    size;
+  size_t mask;
+  size_t stride;
+  size_t bytes;  // Size of the slot array, in whole cache lines.
+} layout_t;
+
+static layout_t layout(int size, size_t elem_size, size_t align, int flags) {
 
-  // Allocate the buffer array.
-  tuple_t *array = malloc(size*sizeof(tuple_t));
+  if (align == 0) {
+    align = _Alignof(max_align_t);
+  }
+
+  if ((align & (align - 1)) != 0 || align > CACHE_LINE_SIZE) {
+    fprintf(stderr, "Buffer element alignment %zu is not a power of two up to %d\n",
+            align, CACHE_LINE_SIZE);
+    exit(EXIT_FAILURE);
+  }
+
+  if ((flags & BUFFER_SPSC) && (flags & BUFFER_MPMC)) {
+    fprintf(stderr, "BUFFER_SPSC and BUFFER_MPMC are mutually exclusive\n");
+    exit(EXIT_FAILURE);
+  }
+
+  layout_t l = { size, 0, slot_stride(elem_size, align), 0 };
+
+  // Round the capacity up to a power of two so that indices can be masked.
+  if (flags & BUFFER_POW2) {
+    int pow2 = 1;
+    while (pow2 < size) pow2 <<= 1;
+    l.size = pow2;
+    l.mask = pow2 - 1;
+  }
+
+  l.bytes = (l.size*l.stride + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+  return l;
+}
+
+/* Sets up buffer with its slots in array and, with BUFFER_MPMC, its sequence
+   numbers in seq. */
+static void setup(buffer_t *buffer, layout_t l, size_t elem_size,
+                  void *array, atomic_size_t *seq, int flags) {
+  bool shared = flags & BUFFER_SHARED;
+
+  // Pointers are only valid in the process that created the buffer.
+  buffer->array = shared ? NULL : array;
+  buffer->slots = shared ? NULL : array;
+  buffer->seq   = shared ? NULL : seq;
+  buffer->slots_offset = shared ? (unsigned char *) array - (unsigned char *) buffer : 0;
+  buffer->seq_offset   = (shared && seq) ? (unsigned char *) seq - (unsigned char *) buffer : 0;
+
+  buffer->elem_size = elem_size;
+  buffer->stride = l.stride;
+  buffer->size  = l.size;
+  buffer->mask  = l.mask;
+  buffer->in    = 0;
+  buffer->out   = 0;
+  buffer->flags = flags;
+
+  if (flags & BUFFER_MPMC) {
+    // Slot i is free for the put with ticket i.
+    for (int i = 0; i < l.size; i++) {
+      atomic_init(&seq[i], i);
+    }
+  }
+
+  void (*sem_init_at)(psem_t *, unsigned int) = shared ? psem_init_shared_at : psem_init_at;
+
+  // Initialize the binary mutex semaphore.
+  sem_init_at(&buffer->mutex_sem, 1);
+  buffer->mutex = shared ? NULL : &buffer->mutex_sem;
+
+  // No data in the buffer and all slots empty.
+  sem_init_at(&buffer->data_sem, 0);
+  sem_init_at(&buffer->empty_sem, l.size);
+  buffer->data  = shared ? NULL : &buffer->data_sem;
+  buffer->empty = shared ? NULL : &buffer->empty_sem;
+
+  // Only used by a lock-free single producer single consumer buffer.
+  void (*event_init_at)(pevent_t *) = shared ? pevent_init_shared_at : pevent_init_at;
+
+  event_init_at(&buffer->room_event);
+  event_init_at(&buffer->data_event);
+
+  psem_trace_name(&buffer->mutex_sem, "buffer mutex");
+  psem_trace_name(&buffer->data_sem, "buffer data");
+  psem_trace_name(&buffer->empty_sem, "buffer empty");
+
+  atomic_init(&buffer->stats, NULL);
+  atomic_init(&buffer->closed, false);
+
+  if ((flags & BUFFER_STATS) && pthread_key_create(&buffer->stats_key, NULL) != 0) {
+    perror("pthread_key_create()");
+    exit(EXIT_FAILURE);
+  }
+
+  buffer->spin_max = SPIN_BUDGET_MAX;
+  waiter_init(&buffer->put_wait);
+  waiter_init(&buffer->get_wait);
+
+  atomic_init(&buffer->head, 0);
+  atomic_init(&buffer->tail, 0);
+  buffer->tail_cache = 0;
+  buffer->head_cache = 0;
+}
+
+void buffer_init_elem(buffer_t *buffer, int size, size_t elem_size, size_t align, int flags) {
+  layout_t l = layout(size, elem_size, align, flags);
+
+  // Allocate the buffer array, starting on a cache line boundary.
+  void *array = aligned_alloc(CACHE_LINE_SIZE, l.bytes);
 
   if (array == NULL) {
     perror("Could not allocate buffer array");
     exit(EXIT_FAILURE);
- }
+  }
 
-  // Initialize the binary mutex semaphore.
-  buffer->mutex = psem_init(1);
+  atomic_size_t *seq = NULL;
 
-  // TODO: initialize the rest of the buffer struct members.
+  if (flags & BUFFER_MPMC) {
+    seq = malloc(l.size*sizeof(atomic_size_t));
 
+    if (seq == NULL) {
+      perror("Could not allocate buffer sequence numbers");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  setup(buffer, l, elem_size, array, seq, flags & ~BUFFER_SHARED);
 }
 
 void buffer_destroy(buffer_t *buffer) {
 
+  if (buffer->flags & BUFFER_SHARED) {
+    fprintf(stderr, "A shared buffer is closed with buffer_shm_close(), not destroyed\n");
+    exit(EXIT_FAILURE);
+  }
+
   // Dealloacte the array.
   free(buffer->array);
   buffer->array = NULL;
+  buffer->slots = NULL;
+
+  free(buffer->seq);
+  buffer->seq = NULL;
+
+  // Deallocate the statistics of all threads.
+  if (buffer->flags & BUFFER_STATS) {
+    struct buffer_stats_block *block = atomic_load(&buffer->stats);
 
-  // Deallocate the mutex semaphore.
-  psem_destroy(buffer->mutex);
+    while (block != NULL) {
+      struct buffer_stats_block *next = block->next;
+      free(block);
+      block = next;
+    }
+    atomic_store(&buffer->stats, NULL);
+    pthread_key_delete(buffer->stats_key);
+  }
+
+  // Finalize the mutex semaphore.
+  psem_fini(&buffer->mutex_sem);
   buffer->mutex = NULL;
 
-  // TODO: Deallocate any other resources allocated to the bounded buffer.
+  // Finalize the counting semaphores.
+  psem_fini(&buffer->data_sem);
+  buffer->data = NULL;
+
+  psem_fini(&buffer->empty_sem);
+  buffer->empty = NULL;
 
+  pevent_fini(&buffer->room_event);
+  pevent_fini(&buffer->data_event);
 }
 
 void buffer_print(buffer_t *buffer) {
@@ -46,44 +555,954 @@ void buffer_print(buffer_t *buffer) {
   puts("---- Bounded Buffer ----");
   puts("");
 
+  int in  = buffer->in;
+  int out = buffer->out;
+
+  // A multi producer multi consumer buffer only keeps the ticket counters.
+  if (buffer->flags & BUFFER_MPMC) {
+    in  = wrap(buffer, atomic_load(&buffer->head) & ~HEAD_CLOSED);
+    out = wrap(buffer, atomic_load(&buffer->tail));
+  }
+
   printf("size: %d\n", buffer -> size);
-  printf("  in: %d\n", buffer -> in);
-  printf(" out: %d\n", buffer -> out);
+  printf("  in: %d\n", in);
+  printf(" out: %d\n", out);
   puts("");
 
-  int i = 0;
+  for (int i = 0; i < buffer->size; i++) {
+    if (buffer->elem_size == sizeof(tuple_t)) {
+      printf("array[%d]: (%d, %d)\n", i, array_of(buffer)[i].a, array_of(buffer)[i].b);
+      continue;
+    }
 
-  // TODO: print all elements of the array.
+    // Elements of other types are shown as raw bytes.
+    unsigned char *elem = slot_at(buffer, i);
 
-  // Print element i of the array. 
-  printf("array[%d]: (%d, %d)\n", i, buffer->array[i].a, buffer->array[i].b);
+    printf("array[%d]:", i);
+    for (size_t j = 0; j < buffer->elem_size; j++) {
+      printf(" %02x", elem[j]);
+    }
+    puts("");
+  }
 
   puts("");
   puts("------------------------");
   puts("");
 }
 
+/*******************************************************************************
+                     Single producer single consumer (lock-free)
+********************************************************************************/
+
+/* The producer is the only writer of head and in, the consumer the only writer
+   of tail and out. Publishing head with release semantics makes the element
+   written before it visible to the consumer, and publishing tail with release
+   semantics hands the slot back to the producer. */
+
+/* True if there is room for at least one element. Only reads the consumer's
+   cache line when the cached tail says full. */
+static bool spsc_has_room(buffer_t *buffer) {
+  size_t head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+
+  if (head - buffer->tail_cache < (size_t) buffer->size) {
+    return true;
+  }
+  buffer->tail_cache = atomic_load_explicit(&buffer->tail, memory_order_acquire);
+
+  return head - buffer->tail_cache < (size_t) buffer->size;
+}
+
+/* True if there is at least one element. Only reads the producer's cache line
+   when the cached head says empty. */
+static bool spsc_has_data(buffer_t *buffer) {
+  size_t tail = atomic_load_explicit(&buffer->tail, memory_order_relaxed);
+
+  if (buffer->head_cache != tail) {
+    return true;
+  }
+  buffer->head_cache = atomic_load_explicit(&buffer->head, memory_order_acquire);
+
+  return buffer->head_cache != tail;
+}
+
+/* True if a put can proceed: there is room or the buffer is closed. */
+static bool spsc_can_put(buffer_t *buffer) {
+  return atomic_load(&buffer->closed) || spsc_has_room(buffer);
+}
+
+/* True if a get can proceed: there is data or the buffer is closed. Data is
+   published before the buffer is closed, so a get that sees the buffer closed
+   and then no data has reached the end of the stream. */
+static bool spsc_can_get(buffer_t *buffer) {
+  return spsc_has_data(buffer) || atomic_load(&buffer->closed);
+}
+
+/* Wait until ready(buffer) holds. Spin up to SPIN_LIMIT times, or with
+   BUFFER_ADAPTIVE for the side's budget, and then park on ev, which the other
+   side notifies through spsc_wake(). With BUFFER_SPIN only, spin and yield for
+   as long as it takes instead. */
+static bool spsc_wait_adaptive(buffer_t *buffer, waiter_t *w, pevent_t *ev,
+                               bool (*ready)(buffer_t *), const struct timespec *deadline) {
+  int spins = 0;
 
-void buffer_put(buffer_t *buffer, int a, int b) {
-  // TODO: Add the needed synchronization.
+  if (!(buffer->flags & BUFFER_ADAPTIVE)) {
+    do {
+      if (!backoff_until(&spins, deadline)) return false;
+      if (ready(buffer)) return true;
+    } while ((buffer->flags & BUFFER_SPIN) || spins < SPIN_LIMIT);
+  } else {
+    if (deadline == &no_wait) {
+      return false;
+    }
 
-  // Insert the tuple (a, b) into the buffer. 
-  buffer->array[buffer->in].a = a;
-  buffer->array[buffer->in].b = b;
+    int budget = atomic_load_explicit(&w->budget, memory_order_relaxed);
 
-  // TODO: Update buffer->in and make sure it wraps around.
+    for (int i = 0; i < budget; i++) {
+      cpu_relax();
+      if (ready(buffer)) {
+        spin_succeeded(buffer, w);
+        return true;
+      }
+    }
 
-  // TODO: Add the needed synchronization.
+    spin_failed(w);
+  }
+
+  for (;;) {
+    unsigned int key = pevent_prepare_wait(ev);
+
+    if (ready(buffer)) {
+      pevent_cancel_wait(ev);
+      return true;
+    }
+
+    if (deadline == NULL) {
+      pevent_commit_wait(ev, key);
+    } else if (!pevent_commit_timedwait(ev, key, deadline)) {
+      return ready(buffer);
+    }
+
+    if (ready(buffer)) {
+      return true;
+    }
+  }
+}
+
+/* Like spsc_wait_adaptive() but timing the wait if the buffer keeps
+   statistics. */
+static bool spsc_wait(buffer_t *buffer, waiter_t *w, pevent_t *ev,
+                      bool (*ready)(buffer_t *), const struct timespec *deadline) {
+  if (!(buffer->flags & BUFFER_STATS) || deadline == &no_wait) {
+    return spsc_wait_adaptive(buffer, w, ev, ready, deadline);
+  }
+
+  struct timespec start;
+  timing_start(&start);
+
+  bool ok = spsc_wait_adaptive(buffer, w, ev, ready, deadline);
+
+  stats_waited(buffer, w == &buffer->put_wait, timing_stop(&start));
+  return ok;
+}
+
+/* Unpark the other side if it is parked or about to park. Costs a fence and
+   a load when it is not, and nothing when the other side never parks. */
+static void spsc_wake(buffer_t *buffer, pevent_t *ev) {
+  if ((buffer->flags & (BUFFER_SPIN | BUFFER_ADAPTIVE)) != BUFFER_SPIN) {
+    pevent_notify(ev);
+  }
+}
+
+static void *spsc_reserve_put(buffer_t *buffer, const struct timespec *deadline) {
+  if (!spsc_can_put(buffer) &&
+      !spsc_wait(buffer, &buffer->put_wait, &buffer->room_event, spsc_can_put, deadline)) {
+    return NULL;
+  }
+
+  if (atomic_load(&buffer->closed)) {
+    return NULL;
+  }
+
+  return slot_at(buffer, buffer->in);
+}
+
+static void spsc_commit_put(buffer_t *buffer) {
+  size_t head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+
+  buffer->in = (buffer->in + 1 == buffer->size) ? 0 : buffer->in + 1;
+
+  atomic_store_explicit(&buffer->head, head + 1, memory_order_release);
+
+  spsc_wake(buffer, &buffer->data_event);
 }
 
-void buffer_get(buffer_t *buffer, tuple_t *tuple) {
-  // TODO: Add the needed synchronization.
+static void *spsc_reserve_get(buffer_t *buffer, const struct timespec *deadline) {
+  if (!spsc_can_get(buffer) &&
+      !spsc_wait(buffer, &buffer->get_wait, &buffer->data_event, spsc_can_get, deadline)) {
+    return NULL;
+  }
+
+  // Closed and drained.
+  if (!spsc_has_data(buffer)) {
+    return NULL;
+  }
+
+  return slot_at(buffer, buffer->out);
+}
+
+static void spsc_commit_get(buffer_t *buffer) {
+  size_t tail = atomic_load_explicit(&buffer->tail, memory_order_relaxed);
+
+  buffer->out = (buffer->out + 1 == buffer->size) ? 0 : buffer->out + 1;
+
+  atomic_store_explicit(&buffer->tail, tail + 1, memory_order_release);
+
+  spsc_wake(buffer, &buffer->room_event);
+}
+
+static int spsc_put_n(buffer_t *buffer, const tuple_t *tuples, int n) {
+  if (!spsc_can_put(buffer)) {
+    spsc_wait(buffer, &buffer->put_wait, &buffer->room_event, spsc_can_put, NULL);
+  }
+
+  if (atomic_load(&buffer->closed)) {
+    return BUFFER_CLOSED;
+  }
+
+  // Refresh a cached tail that is too old for the whole batch, then settle
+  // for what fits.
+  size_t head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+  size_t room = buffer->size - (head - buffer->tail_cache);
+
+  if (room < (size_t) n) {
+    buffer->tail_cache = atomic_load_explicit(&buffer->tail, memory_order_acquire);
+    room = buffer->size - (head - buffer->tail_cache);
+  }
+  int k = (room < (size_t) n) ? (int) room : n;
+
+  copy_in(buffer, buffer->in, tuples, k);
+  buffer->in = wrap(buffer, buffer->in + k);
+
+  atomic_store_explicit(&buffer->head, head + k, memory_order_release);
+
+  spsc_wake(buffer, &buffer->data_event);
+
+  return k;
+}
+
+static int spsc_get_n(buffer_t *buffer, tuple_t *tuples, int n) {
+  if (!spsc_can_get(buffer)) {
+    spsc_wait(buffer, &buffer->get_wait, &buffer->data_event, spsc_can_get, NULL);
+  }
+
+  // Closed and drained.
+  if (!spsc_has_data(buffer)) {
+    return BUFFER_CLOSED;
+  }
+
+  // Refresh a cached head that is too old for the whole batch, then settle
+  // for what is there.
+  size_t tail = atomic_load_explicit(&buffer->tail, memory_order_relaxed);
+  size_t avail = buffer->head_cache - tail;
+
+  if (avail < (size_t) n) {
+    buffer->head_cache = atomic_load_explicit(&buffer->head, memory_order_acquire);
+    avail = buffer->head_cache - tail;
+  }
+  int k = (avail < (size_t) n) ? (int) avail : n;
+
+  copy_out(buffer, buffer->out, tuples, k);
+  buffer->out = wrap(buffer, buffer->out + k);
+
+  atomic_store_explicit(&buffer->tail, tail + k, memory_order_release);
+
+  spsc_wake(buffer, &buffer->room_event);
+
+  return k;
+}
+
+/*******************************************************************************
+                     Multi producer multi consumer (lock-free)
+********************************************************************************/
+
+/* The empty and data semaphores count free and filled slots, so a thread only
+   blocks when the buffer is full or empty. Once past its semaphore a thread
+   takes a ticket, which maps to a slot. The slot's sequence number tells when
+   the previous owner of the slot is done with it: a producer may find the
+   consumer of the previous lap still reading, and a consumer may find the
+   producer of its ticket still writing. Both waits are short.
+
+   Closing sets a bit in head, so that closing and taking put tickets are
+   ordered by the same atomic variable. Once closed, head no longer moves and
+   a consumer past its semaphore finding no ticket left below head holds the
+   extra unit signaled by buffer_close(). */
+
+/* Take k consecutive put tickets starting at *ticket, unless the buffer is
+   closed. */
+static bool mpmc_claim_put(buffer_t *buffer, size_t k, size_t *ticket) {
+  size_t head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+
+  do {
+    if (head & HEAD_CLOSED) return false;
+  } while (!atomic_compare_exchange_weak_explicit(&buffer->head, &head, head + k,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed));
+  *ticket = head;
+  return true;
+}
+
+/* Take up to k consecutive get tickets starting at *ticket, for tuples put
+   before the buffer was closed. Returns the number of tickets taken, which is
+   only less than k when the buffer is closed. */
+static size_t mpmc_claim_get(buffer_t *buffer, size_t k, size_t *ticket) {
+  size_t tail = atomic_load_explicit(&buffer->tail, memory_order_relaxed);
+  size_t m;
+
+  do {
+    size_t head = atomic_load_explicit(&buffer->head, memory_order_relaxed) & ~HEAD_CLOSED;
+
+    m = (head - tail < k) ? head - tail : k;
+    if (m == 0) return 0;
+  } while (!atomic_compare_exchange_weak_explicit(&buffer->tail, &tail, tail + m,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed));
+  *ticket = tail;
+  return m;
+}
+
+static void *mpmc_reserve_put(buffer_t *buffer, const struct timespec *deadline) {
+  if (!wait_on(buffer, &buffer->put_wait, &buffer->empty_sem, deadline)) {
+    return NULL;
+  }
+
+  size_t ticket;
+
+  // Pass the unit on to the next producer, which also finds the buffer closed.
+  if (!mpmc_claim_put(buffer, 1, &ticket)) {
+    psem_signal(&buffer->empty_sem);
+    return NULL;
+  }
+
+  size_t i = wrap(buffer, ticket);
+  int spins = 0;
+
+  while (atomic_load_explicit(&seq_of(buffer)[i], memory_order_acquire) != ticket) {
+    backoff(&spins);
+  }
+
+  return slot_at(buffer, i);
+}
+
+static void mpmc_commit_put(buffer_t *buffer, void *slot) {
+  size_t i = slot_index(buffer, slot);
+
+  // Only the owner of the reservation writes the sequence number now.
+  size_t ticket = atomic_load_explicit(&seq_of(buffer)[i], memory_order_relaxed);
+
+  atomic_store_explicit(&seq_of(buffer)[i], ticket + 1, memory_order_release);
+
+  psem_signal(&buffer->data_sem);
+}
+
+static void *mpmc_reserve_get(buffer_t *buffer, const struct timespec *deadline) {
+  if (!wait_on(buffer, &buffer->get_wait, &buffer->data_sem, deadline)) {
+    return NULL;
+  }
+
+  size_t ticket;
+
+  // Closed and drained, pass the unit on to the next consumer.
+  if (mpmc_claim_get(buffer, 1, &ticket) == 0) {
+    psem_signal(&buffer->data_sem);
+    return NULL;
+  }
+
+  size_t i = wrap(buffer, ticket);
+  int spins = 0;
+
+  while (atomic_load_explicit(&seq_of(buffer)[i], memory_order_acquire) != ticket + 1) {
+    backoff(&spins);
+  }
+
+  return slot_at(buffer, i);
+}
+
+static void mpmc_commit_get(buffer_t *buffer, void *slot) {
+  size_t i = slot_index(buffer, slot);
+  size_t ticket = atomic_load_explicit(&seq_of(buffer)[i], memory_order_relaxed) - 1;
+
+  // Free the slot for the put one lap ahead.
+  atomic_store_explicit(&seq_of(buffer)[i], ticket + buffer->size, memory_order_release);
+
+  psem_signal(&buffer->empty_sem);
+}
+
+/* A batch takes k consecutive tickets with a single compare-and-swap. */
+
+static int mpmc_put_n(buffer_t *buffer, const tuple_t *tuples, int n) {
+  int k = wait_up_to(buffer, &buffer->put_wait, &buffer->empty_sem, n);
+  size_t ticket;
+
+  if (!mpmc_claim_put(buffer, k, &ticket)) {
+    psem_signal_n(&buffer->empty_sem, k);
+    return BUFFER_CLOSED;
+  }
+
+  for (int j = 0; j < k; j++, ticket++) {
+    size_t i = wrap(buffer, ticket);
+    int spins = 0;
+
+    while (atomic_load_explicit(&seq_of(buffer)[i], memory_order_acquire) != ticket) {
+      backoff(&spins);
+    }
+
+    array_of(buffer)[i] = tuples[j];
+
+    atomic_store_explicit(&seq_of(buffer)[i], ticket + 1, memory_order_release);
+  }
+
+  psem_signal_n(&buffer->data_sem, k);
+  return k;
+}
+
+static int mpmc_get_n(buffer_t *buffer, tuple_t *tuples, int n) {
+  int units = wait_up_to(buffer, &buffer->get_wait, &buffer->data_sem, n);
+  size_t ticket;
+  int k = mpmc_claim_get(buffer, units, &ticket);
+
+  // Units without a tuple are the one signaled by buffer_close(), pass it on.
+  psem_signal_n(&buffer->data_sem, units - k);
+
+  if (k == 0) {
+    return BUFFER_CLOSED;
+  }
+
+  for (int j = 0; j < k; j++, ticket++) {
+    size_t i = wrap(buffer, ticket);
+    int spins = 0;
+
+    while (atomic_load_explicit(&seq_of(buffer)[i], memory_order_acquire) != ticket + 1) {
+      backoff(&spins);
+    }
+
+    tuples[j] = array_of(buffer)[i];
+
+    atomic_store_explicit(&seq_of(buffer)[i], ticket + buffer->size, memory_order_release);
+  }
+
+  psem_signal_n(&buffer->empty_sem, k);
+  return k;
+}
+
+/*******************************************************************************
+                        Mutex and counting semaphores
+********************************************************************************/
+
+/* A reservation holds the mutex until it is committed, so that slots are
+   filled and emptied in the order of in and out. Head and tail are counted
+   under the mutex as well, which tells a consumer holding the extra unit
+   signaled by buffer_close() that there is no tuple left for it. */
+
+static void *locked_reserve_put(buffer_t *buffer, const struct timespec *deadline) {
+  // Wait for an empty slot, then for exclusive access to the buffer. A try or
+  // timed put that cannot get the mutex in time gives the slot back.
+  if (!wait_on(buffer, &buffer->put_wait, &buffer->empty_sem, deadline)) {
+    return NULL;
+  }
+  if (!lock(buffer, deadline)) {
+    psem_signal(&buffer->empty_sem);
+    return NULL;
+  }
+
+  // Pass the unit on to the next producer, which also finds the buffer closed.
+  if (atomic_load_explicit(&buffer->closed, memory_order_relaxed)) {
+    psem_signal(&buffer->mutex_sem);
+    psem_signal(&buffer->empty_sem);
+    return NULL;
+  }
+
+  return slot_at(buffer, buffer->in);
+}
+
+static void locked_commit_put(buffer_t *buffer) {
+  buffer->in = wrap(buffer, buffer->in + 1);
+  bump(&buffer->head, 1);
+
+  psem_signal(&buffer->mutex_sem);
+  psem_signal(&buffer->data_sem);
+}
+
+static void *locked_reserve_get(buffer_t *buffer, const struct timespec *deadline) {
+  // Wait for data, then for exclusive access to the buffer, giving the data
+  // back as a put does its slot.
+  if (!wait_on(buffer, &buffer->get_wait, &buffer->data_sem, deadline)) {
+    return NULL;
+  }
+  if (!lock(buffer, deadline)) {
+    psem_signal(&buffer->data_sem);
+    return NULL;
+  }
+
+  // Closed and drained, pass the unit on to the next consumer.
+  if (atomic_load_explicit(&buffer->head, memory_order_relaxed) ==
+      atomic_load_explicit(&buffer->tail, memory_order_relaxed)) {
+    psem_signal(&buffer->mutex_sem);
+    psem_signal(&buffer->data_sem);
+    return NULL;
+  }
+
+  return slot_at(buffer, buffer->out);
+}
+
+static void locked_commit_get(buffer_t *buffer) {
+  buffer->out = wrap(buffer, buffer->out + 1);
+  bump(&buffer->tail, 1);
+
+  psem_signal(&buffer->mutex_sem);
+  psem_signal(&buffer->empty_sem);
+}
+
+static int locked_put_n(buffer_t *buffer, const tuple_t *tuples, int n) {
+  // Wait for at least one empty slot and grab as many more as are free.
+  int k = wait_up_to(buffer, &buffer->put_wait, &buffer->empty_sem, n);
+
+  lock(buffer, NULL);
+
+  if (atomic_load_explicit(&buffer->closed, memory_order_relaxed)) {
+    psem_signal(&buffer->mutex_sem);
+    psem_signal_n(&buffer->empty_sem, k);
+    return BUFFER_CLOSED;
+  }
+
+  copy_in(buffer, buffer->in, tuples, k);
+  buffer->in = wrap(buffer, buffer->in + k);
+  bump(&buffer->head, k);
+
+  psem_signal(&buffer->mutex_sem);
+
+  psem_signal_n(&buffer->data_sem, k);
+  return k;
+}
+
+static int locked_get_n(buffer_t *buffer, tuple_t *tuples, int n) {
+  // Wait for at least one tuple and grab as many more as are available.
+  int units = wait_up_to(buffer, &buffer->get_wait, &buffer->data_sem, n);
+
+  lock(buffer, NULL);
+
+  // Units without a tuple are the one signaled by buffer_close().
+  size_t avail = atomic_load_explicit(&buffer->head, memory_order_relaxed) -
+    atomic_load_explicit(&buffer->tail, memory_order_relaxed);
+  int k = (avail < (size_t) units) ? (int) avail : units;
+
+  copy_out(buffer, buffer->out, tuples, k);
+  buffer->out = wrap(buffer, buffer->out + k);
+  bump(&buffer->tail, k);
+
+  psem_signal(&buffer->mutex_sem);
+
+  psem_signal_n(&buffer->data_sem, units - k);
+  psem_signal_n(&buffer->empty_sem, k);
+
+  return (k > 0) ? k : BUFFER_CLOSED;
+}
+
+/*******************************************************************************
+                                 Shared buffers
+********************************************************************************/
+
+/* A shared memory segment holds the buffer, followed by its sequence numbers
+   and its slots. */
+struct shm_segment {
+  atomic_uint ready;  // Set once the creator has set up the buffer.
+  size_t bytes;       // Size of the segment.
+  _Alignas(CACHE_LINE_SIZE) buffer_t buffer;
+};
+
+buffer_t *buffer_shm_create(const char *name, int size, size_t elem_size, size_t align, int flags) {
+
+  if (flags & BUFFER_STATS) {
+    fprintf(stderr, "A shared buffer cannot keep statistics (BUFFER_STATS)\n");
+    exit(EXIT_FAILURE);
+  }
+
+  layout_t l = layout(size, elem_size, align, flags);
+
+  size_t seq_bytes = 0;
+
+  if (flags & BUFFER_MPMC) {
+    seq_bytes = (l.size*sizeof(atomic_size_t) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+  }
+
+  size_t bytes = sizeof(struct shm_segment) + seq_bytes + l.bytes;
+
+  int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+
+  if (fd == -1) {
+    perror("shm_open()");
+    exit(EXIT_FAILURE);
+  }
+
+  if (ftruncate(fd, bytes) == -1) {
+    perror("ftruncate()");
+    exit(EXIT_FAILURE);
+  }
+
+  struct shm_segment *segment = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+  if (segment == MAP_FAILED) {
+    perror("mmap()");
+    exit(EXIT_FAILURE);
+  }
+
+  close(fd);
+
+  // The segment is page aligned and its header a whole number of cache lines.
+  unsigned char *seq = (unsigned char *) (segment + 1);
+
+  segment->bytes = bytes;
+  setup(&segment->buffer, l, elem_size, seq + seq_bytes,
+        (flags & BUFFER_MPMC) ? (atomic_size_t *) seq : NULL, flags | BUFFER_SHARED);
+
+  atomic_store_explicit(&segment->ready, 1, memory_order_release);
+
+  return &segment->buffer;
+}
+
+buffer_t *buffer_shm_open(const char *name) {
+  struct stat st;
+  int fd = shm_open(name, O_RDWR, 0);
+
+  if (fd == -1) {
+    perror("shm_open()");
+    exit(EXIT_FAILURE);
+  }
+
+  // The creator may not have sized the segment yet.
+  do {
+    if (fstat(fd, &st) == -1) {
+      perror("fstat()");
+      exit(EXIT_FAILURE);
+    }
+  } while (st.st_size == 0 && usleep(1000) == 0);
+
+  struct shm_segment *segment = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+  if (segment == MAP_FAILED) {
+    perror("mmap()");
+    exit(EXIT_FAILURE);
+  }
+
+  close(fd);
+
+  // Nor set up the buffer.
+  while (!atomic_load_explicit(&segment->ready, memory_order_acquire)) {
+    usleep(1000);
+  }
+
+  return &segment->buffer;
+}
+
+void buffer_shm_close(buffer_t *buffer) {
+  struct shm_segment *segment =
+    (struct shm_segment *) ((unsigned char *) buffer - offsetof(struct shm_segment, buffer));
+
+  if (munmap(segment, segment->bytes) == -1) {
+    perror("munmap()");
+    exit(EXIT_FAILURE);
+  }
+}
+
+void buffer_shm_unlink(const char *name) {
+  if (shm_unlink(name) == -1) {
+    perror("shm_unlink()");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/*******************************************************************************
+                                   Buffer API
+********************************************************************************/
+
+static void *reserve_put(buffer_t *buffer, const struct timespec *deadline) {
+  if (buffer->flags & BUFFER_SPSC) {
+    return spsc_reserve_put(buffer, deadline);
+  }
+
+  if (buffer->flags & BUFFER_MPMC) {
+    return mpmc_reserve_put(buffer, deadline);
+  }
+
+  return locked_reserve_put(buffer, deadline);
+}
+
+static void *reserve_get(buffer_t *buffer, const struct timespec *deadline) {
+  if (buffer->flags & BUFFER_SPSC) {
+    return spsc_reserve_get(buffer, deadline);
+  }
+
+  if (buffer->flags & BUFFER_MPMC) {
+    return mpmc_reserve_get(buffer, deadline);
+  }
+
+  return locked_reserve_get(buffer, deadline);
+}
+
+/* Result of an operation that did not move a tuple: the buffer was closed,
+   or else it was full or empty until the deadline. */
+static int failed(buffer_t *buffer, int status) {
+  return atomic_load(&buffer->closed) ? BUFFER_CLOSED : status;
+}
+
+void *buffer_reserve_put(buffer_t *buffer) {
+  return reserve_put(buffer, NULL);
+}
+
+void buffer_commit_put(buffer_t *buffer, void *slot) {
+  if (buffer->flags & BUFFER_SPSC) {
+    spsc_commit_put(buffer);
+  } else if (buffer->flags & BUFFER_MPMC) {
+    mpmc_commit_put(buffer, slot);
+  } else {
+    locked_commit_put(buffer);
+  }
+
+  stats_moved(buffer, true, 1);
+}
+
+const void *buffer_reserve_get(buffer_t *buffer) {
+  return reserve_get(buffer, NULL);
+}
+
+void buffer_commit_get(buffer_t *buffer, const void *slot) {
+  if (buffer->flags & BUFFER_SPSC) {
+    spsc_commit_get(buffer);
+  } else if (buffer->flags & BUFFER_MPMC) {
+    mpmc_commit_get(buffer, (void *) slot);
+  } else {
+    locked_commit_get(buffer);
+  }
+
+  stats_moved(buffer, false, 1);
+}
+
+int buffer_put_elem(buffer_t *buffer, const void *elem) {
+  void *slot = buffer_reserve_put(buffer);
+
+  if (slot == NULL) {
+    return BUFFER_CLOSED;
+  }
+
+  memcpy(slot, elem, buffer->elem_size);
+  buffer_commit_put(buffer, slot);
+  return BUFFER_OK;
+}
+
+int buffer_get_elem(buffer_t *buffer, void *elem) {
+  const void *slot = buffer_reserve_get(buffer);
+
+  if (slot == NULL) {
+    return BUFFER_CLOSED;
+  }
+
+  memcpy(elem, slot, buffer->elem_size);
+  buffer_commit_get(buffer, slot);
+  return BUFFER_OK;
+}
+
+static bool put(buffer_t *buffer, int a, int b, const struct timespec *deadline) {
+  tuple_t *tuple = reserve_put(buffer, deadline);
+
+  if (tuple == NULL) {
+    return false;
+  }
+
+  // Insert the tuple (a, b) into the buffer.
+  tuple->a = a;
+  tuple->b = b;
+
+  buffer_commit_put(buffer, tuple);
+  return true;
+}
+
+static bool get(buffer_t *buffer, tuple_t *tuple, const struct timespec *deadline) {
+  const tuple_t *slot = reserve_get(buffer, deadline);
+
+  if (slot == NULL) {
+    return false;
+  }
 
   // Read the tuple (a, b) from the buffer.
-  tuple->a = buffer->array[buffer->out].a;
-  tuple->b = buffer->array[buffer->out].b;
+  tuple->a = slot->a;
+  tuple->b = slot->b;
+
+  buffer_commit_get(buffer, slot);
+  return true;
+}
+
+int buffer_put(buffer_t *buffer, int a, int b) {
+  return put(buffer, a, b, NULL) ? BUFFER_OK : BUFFER_CLOSED;
+}
+
+int buffer_get(buffer_t *buffer, tuple_t *tuple) {
+  return get(buffer, tuple, NULL) ? BUFFER_OK : BUFFER_CLOSED;
+}
+
+int buffer_try_put(buffer_t *buffer, int a, int b) {
+  return put(buffer, a, b, &no_wait) ? BUFFER_OK : failed(buffer, BUFFER_WOULDBLOCK);
+}
+
+int buffer_try_get(buffer_t *buffer, tuple_t *tuple) {
+  return get(buffer, tuple, &no_wait) ? BUFFER_OK : failed(buffer, BUFFER_WOULDBLOCK);
+}
+
+int buffer_timed_put(buffer_t *buffer, int a, int b, const struct timespec *abstime) {
+  return put(buffer, a, b, abstime) ? BUFFER_OK : failed(buffer, BUFFER_TIMEDOUT);
+}
+
+int buffer_timed_get(buffer_t *buffer, tuple_t *tuple, const struct timespec *abstime) {
+  return get(buffer, tuple, abstime) ? BUFFER_OK : failed(buffer, BUFFER_TIMEDOUT);
+}
+
+void buffer_close(buffer_t *buffer) {
+  if (buffer->flags & BUFFER_MPMC) {
+    atomic_fetch_or(&buffer->head, HEAD_CLOSED);
+    atomic_store(&buffer->closed, true);
+  } else if (buffer->flags & BUFFER_SPSC) {
+    atomic_store(&buffer->closed, true);
+  } else {
+    psem_wait(&buffer->mutex_sem);
+    atomic_store(&buffer->closed, true);
+    psem_signal(&buffer->mutex_sem);
+  }
+
+  if (buffer->flags & BUFFER_SPSC) {
+    // Unpark a parked producer or consumer.
+    spsc_wake(buffer, &buffer->room_event);
+    spsc_wake(buffer, &buffer->data_event);
+  } else {
+    // One extra unit each, passed on from waiter to waiter, wakes up all
+    // producers and all consumers once the buffer is drained.
+    psem_signal(&buffer->empty_sem);
+    psem_signal(&buffer->data_sem);
+  }
+}
+
+int buffer_put_n(buffer_t *buffer, const tuple_t *tuples, int n) {
+  if (n <= 0) {
+    return 0;
+  }
+
+  int k;
+
+  if (buffer->flags & BUFFER_SPSC) {
+    k = spsc_put_n(buffer, tuples, n);
+  } else if (buffer->flags & BUFFER_MPMC) {
+    k = mpmc_put_n(buffer, tuples, n);
+  } else {
+    k = locked_put_n(buffer, tuples, n);
+  }
+
+  if (k > 0) {
+    stats_moved(buffer, true, k);
+  }
+  return k;
+}
+
+int buffer_get_n(buffer_t *buffer, tuple_t *tuples, int n) {
+  if (n <= 0) {
+    return 0;
+  }
+
+  int k;
 
-  // TODO: Update buffer->out and make sure it wraps around.
+  if (buffer->flags & BUFFER_SPSC) {
+    k = spsc_get_n(buffer, tuples, n);
+  } else if (buffer->flags & BUFFER_MPMC) {
+    k = mpmc_get_n(buffer, tuples, n);
+  } else {
+    k = locked_get_n(buffer, tuples, n);
+  }
 
-  // TODO: Add the needed synchronization.
+  if (k > 0) {
+    stats_moved(buffer, false, k);
+  }
+  return k;
+}
+
+void buffer_set_spin_max(buffer_t *buffer, int spin_max) {
+  buffer->spin_max = (spin_max < SPIN_BUDGET_MIN) ? SPIN_BUDGET_MIN : spin_max;
+}
+
+void buffer_wait_stats(buffer_t *buffer, buffer_wait_stats_t *stats) {
+  stats->put_spins  = atomic_load_explicit(&buffer->put_wait.spins, memory_order_relaxed);
+  stats->put_parks  = atomic_load_explicit(&buffer->put_wait.parks, memory_order_relaxed);
+  stats->put_budget = atomic_load_explicit(&buffer->put_wait.budget, memory_order_relaxed);
+  stats->get_spins  = atomic_load_explicit(&buffer->get_wait.spins, memory_order_relaxed);
+  stats->get_parks  = atomic_load_explicit(&buffer->get_wait.parks, memory_order_relaxed);
+  stats->get_budget = atomic_load_explicit(&buffer->get_wait.budget, memory_order_relaxed);
+}
+
+void buffer_stats(buffer_t *buffer, buffer_stats_t *stats) {
+  memset(stats, 0, sizeof(*stats));
+
+  struct buffer_stats_block *block = atomic_load(&buffer->stats);
+
+  for (; block != NULL; block = block->next) {
+    stats->puts         += atomic_load_explicit(&block->puts, memory_order_relaxed);
+    stats->gets         += atomic_load_explicit(&block->gets, memory_order_relaxed);
+    stats->full_waits   += atomic_load_explicit(&block->full_waits, memory_order_relaxed);
+    stats->empty_waits  += atomic_load_explicit(&block->empty_waits, memory_order_relaxed);
+    stats->full_time    += atomic_load_explicit(&block->full_ns, memory_order_relaxed) * 1E-9;
+    stats->empty_time   += atomic_load_explicit(&block->empty_ns, memory_order_relaxed) * 1E-9;
+    stats->contended    += atomic_load_explicit(&block->contended, memory_order_relaxed);
+
+    size_t high_water = atomic_load_explicit(&block->high_water, memory_order_relaxed);
+    if (high_water > stats->high_water) {
+      stats->high_water = high_water;
+    }
+
+    for (int i = 0; i < BUFFER_STATS_BUCKETS; i++) {
+      stats->occupancy[i] += atomic_load_explicit(&block->occupancy[i], memory_order_relaxed);
+    }
+  }
+}
+
+void buffer_stats_print(buffer_t *buffer) {
+  buffer_stats_t stats;
+  size_t samples = 0;
+
+  buffer_stats(buffer, &stats);
+
+  for (int i = 0; i < BUFFER_STATS_BUCKETS; i++) {
+    samples += stats.occupancy[i];
+  }
+
+  puts("");
+  puts("---- Bounded Buffer Statistics ----");
+  puts("");
+
+  printf("        puts: %zu\n", stats.puts);
+  printf("        gets: %zu\n", stats.gets);
+  printf("   full wait: %zu times, %.6f s\n", stats.full_waits, stats.full_time);
+  printf("  empty wait: %zu times, %.6f s\n", stats.empty_waits, stats.empty_time);
+  printf("   contended: %zu\n", stats.contended);
+  printf("  high water: %zu of %d\n", stats.high_water, buffer->size);
+  puts("");
+  puts("Occupancy:");
+
+  for (int i = 0; i < BUFFER_STATS_BUCKETS; i++) {
+    if (stats.occupancy[i] == 0) continue;
+
+    // Bucket i holds occupancies o with o*BUCKETS/(size+1) == i.
+    int low  = (i * (buffer->size + 1) + BUFFER_STATS_BUCKETS - 1) / BUFFER_STATS_BUCKETS;
+    int high = ((i + 1) * (buffer->size + 1) - 1) / BUFFER_STATS_BUCKETS;
+
+    printf("  %4d - %4d: %10zu (%5.1f%%)\n", low, high, stats.occupancy[i],
+           100.0 * stats.occupancy[i] / samples);
+  }
+
+  puts("");
+  puts("-----------------------------------");
+  puts("");
 }
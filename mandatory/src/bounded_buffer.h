@@ -1,23 +1,381 @@
+#ifndef BOUNDED_BUFFER_H
+#define BOUNDED_BUFFER_H
+
+#include <stdatomic.h> // atomic_size_t, atomic_bool
+#include <stddef.h>    // size_t
+#include <time.h>      // struct timespec
+#include <pthread.h>   // pthread_key_t
+
 #include "psem.h" // init_sem(), wait_sem(), signal_sem(), destroy_sem()
 
+/* Assumed size in bytes of a cache line, used to keep data written by
+   producers and data written by consumers apart. */
+#define CACHE_LINE_SIZE 64
+
 typedef struct {
   int a;
   int b;
 } tuple_t;
 
+/* Flags selecting the synchronization strategy of a buffer, passed to
+   buffer_init_flags(). Without any flags the buffer is protected by a binary
+   mutex semaphore and two counting semaphores and can be used by any number of
+   producers and consumers.
+
+   BUFFER_SPSC - lock-free ring for exactly one producer thread and exactly one
+                 consumer thread. No semaphores are used on the fast path.
+
+   BUFFER_MPMC - lock-free ring for any number of producers and consumers.
+                 Slots are claimed with an atomic increment and handed over
+                 using a sequence number per slot. The data and empty
+                 semaphores are only used to block on a full or empty buffer,
+                 the mutex is never taken.
+
+   BUFFER_ADAPTIVE - when the buffer is full or empty, spin for a while before
+                 parking the thread. The spin budget adjusts itself to how
+                 long waits tend to be, see buffer_set_spin_max() and
+                 buffer_wait_stats(). May be combined with any of the above.
+
+   BUFFER_STATS - keep statistics of how the buffer is used, see
+                 buffer_stats(). May be combined with any of the above.
+
+   BUFFER_POW2 - round the capacity up to a power of two so that slot indices
+                 wrap around with a mask instead of a division. May be combined
+                 with any of the above.
+
+   BUFFER_SHARED - set on buffers in shared memory created by
+                 buffer_shm_create(), not passed by callers.
+
+   BUFFER_SPIN - with BUFFER_SPSC, never park a producer or consumer that finds
+                 the buffer full or empty but keep spinning and yielding the
+                 processor until it can go on. Saves the wake-up on every
+                 wait at the cost of a busy processor for as long as the wait
+                 lasts, so it only suits pipelines that are never idle for
+                 long. Ignored with BUFFER_ADAPTIVE.
+*/
+enum {
+  BUFFER_SPSC = 1 << 0,
+  BUFFER_MPMC = 1 << 1,
+  BUFFER_POW2 = 1 << 2,
+  BUFFER_ADAPTIVE = 1 << 3,
+  BUFFER_STATS = 1 << 4,
+  BUFFER_SHARED = 1 << 5,
+  BUFFER_SPIN = 1 << 6,
+};
+
+/* Number of buckets in the occupancy histogram of buffer_stats_t. */
+#define BUFFER_STATS_BUCKETS 16
+
+/* Usage statistics of a BUFFER_STATS buffer, see buffer_stats(). */
+typedef struct {
+  size_t puts;         // Elements put.
+  size_t gets;         // Elements taken.
+  size_t full_waits;   // Puts that had to wait for room.
+  size_t empty_waits;  // Gets that had to wait for data.
+  double full_time;    // Total time in seconds puts waited for room.
+  double empty_time;   // Total time in seconds gets waited for data.
+  size_t contended;    // Times the mutex was already taken (locked buffer).
+  size_t high_water;   // Highest occupancy seen.
+
+  /* Occupancy seen after puts and gets. Bucket i counts occupancies o with
+     o * BUFFER_STATS_BUCKETS / (size + 1) == i. */
+  size_t occupancy[BUFFER_STATS_BUCKETS];
+} buffer_stats_t;
+
+/* Per-thread counters of a BUFFER_STATS buffer. */
+struct buffer_stats_block;
+
+/* Spin and park counters of a BUFFER_ADAPTIVE buffer, see
+   buffer_wait_stats(). */
+typedef struct {
+  size_t put_spins;   // Waits for room that ended while spinning.
+  size_t put_parks;   // Waits for room that had to park.
+  int    put_budget;  // Current spin budget of producers.
+  size_t get_spins;   // Waits for data that ended while spinning.
+  size_t get_parks;   // Waits for data that had to park.
+  int    get_budget;  // Current spin budget of consumers.
+} buffer_wait_stats_t;
+
+/* Results of the buffer operations that may return without moving a tuple. */
+enum {
+  BUFFER_OK         =  0, // The operation succeeded.
+  BUFFER_WOULDBLOCK = -1, // The buffer was full (put) or empty (get).
+  BUFFER_TIMEDOUT   = -2, // The deadline passed with the buffer full or empty.
+  BUFFER_CLOSED     = -3, // The buffer was closed (put) or closed and drained (get).
+};
+
+/* Spin-then-park state of the producer side or the consumer side of a
+   BUFFER_ADAPTIVE buffer. */
+typedef struct {
+  atomic_int    budget;  // Current spin budget.
+  atomic_size_t spins;   // Waits that ended while spinning.
+  atomic_size_t parks;   // Waits that had to park.
+} waiter_t;
+
+/* The fields are grouped by who writes them. Fields set up by buffer_init()
+   and only read afterwards come first. The producer side and the consumer side
+   each get a padded cache line of their own, so that producers and consumers
+   do not invalidate each other's cache lines on every operation. */
+
 typedef struct {
+  /* The pointers to the array, its sequence numbers and the semaphores are
+     NULL in a shared buffer, where they would only be valid in the process
+     that created it. A shared buffer finds them at an offset instead, and a
+     private buffer leaves the offsets 0. */
   tuple_t *array;
+  unsigned char *slots;  // The array as raw bytes, one slot every stride bytes.
+  size_t  slots_offset;  // Offset of the array from a shared buffer.
+  size_t  seq_offset;    // Offset of seq from a shared buffer.
+  size_t  elem_size;     // Size of an element, sizeof(tuple_t) for tuples.
+  size_t  stride;
   int     size;
-  int     in;
-  int     out;
-  psem_t  *mutex;
+  size_t  mask;          // size - 1 with BUFFER_POW2, otherwise 0.
+  psem_t  *mutex;         // Point to the semaphore storage below.
   psem_t  *data;
   psem_t  *empty;
+  int     flags;
+  int     spin_max;      // Largest spin budget with BUFFER_ADAPTIVE.
+  atomic_bool closed;    // Set by buffer_close().
+
+  /* BUFFER_STATS only. Finds the calling thread's counters, and links the
+     counters of all threads. */
+  pthread_key_t stats_key;
+  _Atomic(struct buffer_stats_block *) stats;
+
+  /* BUFFER_MPMC only. Sequence number of each slot in array. Slot i is free
+     for the put with ticket t when seq[i] == t and holds the tuple for the get
+     with ticket t when seq[i] == t + 1. */
+  atomic_size_t *seq;
+
+  /* Producer side: the next slot to put into and the number of tuples ever
+     put (head). For BUFFER_SPSC the producer is the only writer of this line
+     and keeps a private copy of the consumer's tail. For BUFFER_MPMC head is
+     the next put ticket and in is not maintained. */
+  _Alignas(CACHE_LINE_SIZE) int in;
+  atomic_size_t head;
+  size_t  tail_cache;
+  waiter_t put_wait;
+
+  /* Consumer side, mirroring the producer side. */
+  _Alignas(CACHE_LINE_SIZE) int out;
+  atomic_size_t tail;
+  size_t  head_cache;
+  waiter_t get_wait;
+
+  /* The semaphores live inside the buffer, on a line of their own, rather
+     than in separate allocations. A BUFFER_SPSC buffer parks its producer on
+     room_event and its consumer on data_event instead. */
+  _Alignas(CACHE_LINE_SIZE) psem_t mutex_sem;
+  psem_t  data_sem;
+  psem_t  empty_sem;
+  pevent_t room_event;
+  pevent_t data_event;
 } buffer_t;
 
 
 void buffer_print(buffer_t *buffer);
 void buffer_init(buffer_t *buffer, int size);
+void buffer_init_flags(buffer_t *buffer, int size, int flags);
+
+/* buffer_init_elem(buffer, size, elem_size, align, flags)
+
+   Initializes a buffer with room for size elements of elem_size bytes each,
+   aligned to align bytes (a power of two up to CACHE_LINE_SIZE, 0 for the
+   alignment of max_align_t). The array starts on a cache line. Slots are
+   padded to a power of two below a cache line, and to whole cache lines above
+   it, so that no element straddles two cache lines.
+
+   Elements are moved with buffer_put_elem() and buffer_get_elem(), or built
+   and read in place with the reserve and commit functions. The tuple
+   functions must only be used on buffers created by buffer_init() or
+   buffer_init_flags().
+*/
+void buffer_init_elem(buffer_t *buffer, int size, size_t elem_size, size_t align, int flags);
 void buffer_destroy(buffer_t *buffer);
-void buffer_put(buffer_t *buffer, int a, int b);
-void buffer_get(buffer_t *buffer, tuple_t *tuple);
+
+/* buffer_shm_create(name, size, elem_size, align, flags)
+
+   Creates a buffer in a new POSIX shared memory object called name, see
+   shm_open(), for use by several processes. The buffer is laid out as by
+   buffer_init_elem() and its semaphores are process-shared. Other processes
+   map the buffer with buffer_shm_open(name). Elements built and read in place
+   with the reserve and commit functions move between processes without being
+   copied. BUFFER_STATS cannot be used.
+
+   Return value
+
+   The buffer, mapped into the calling process. Exits the program if the
+   shared memory object already exists or cannot be created.
+*/
+buffer_t *buffer_shm_create(const char *name, int size, size_t elem_size, size_t align, int flags);
+
+/* buffer_shm_open(name)
+
+   Maps the buffer created by buffer_shm_create(name, ...), possibly by
+   another process, into the calling process, waiting for its creator to set
+   it up.
+*/
+buffer_t *buffer_shm_open(const char *name);
+
+/* buffer_shm_close(buffer)
+
+   Unmaps a shared buffer from the calling process. The buffer lives on until
+   its name is unlinked with buffer_shm_unlink(name) and all processes have
+   closed it.
+*/
+void buffer_shm_close(buffer_t *buffer);
+void buffer_shm_unlink(const char *name);
+
+/* buffer_put(buffer, a, b)
+   buffer_get(buffer, tuple)
+
+   Put the tuple (a, b) into the buffer, waiting for room, or get the oldest
+   tuple from the buffer, waiting for data.
+
+   Return value
+
+   BUFFER_OK on success. BUFFER_CLOSED if the buffer was closed (put), or
+   closed with no tuples left (get).
+*/
+int buffer_put(buffer_t *buffer, int a, int b);
+int buffer_get(buffer_t *buffer, tuple_t *tuple);
+
+/* buffer_close(buffer)
+
+   Closes the buffer. Later puts fail and puts waiting for room are woken up
+   and fail. Gets go on taking the tuples left in the buffer, after which they
+   return BUFFER_CLOSED instead of waiting. Closing twice has no further
+   effect.
+
+   A BUFFER_SPSC buffer must be closed by its producer, or once its producer
+   has stopped putting.
+*/
+void buffer_close(buffer_t *buffer);
+
+/* buffer_try_put(buffer, a, b)
+   buffer_try_get(buffer, tuple)
+
+   Like buffer_put() and buffer_get() but never wait for room or data, nor
+   for the mutex of a locked buffer.
+
+   Return value
+
+   BUFFER_OK on success, BUFFER_WOULDBLOCK if the buffer was full or empty or
+   another thread held its mutex, BUFFER_CLOSED as for buffer_put() and
+   buffer_get().
+*/
+int buffer_try_put(buffer_t *buffer, int a, int b);
+int buffer_try_get(buffer_t *buffer, tuple_t *tuple);
+
+/* buffer_timed_put(buffer, a, b, abstime)
+   buffer_timed_get(buffer, tuple, abstime)
+
+   Like buffer_put() and buffer_get() but wait for room or data, and for the
+   mutex of a locked buffer, no longer than until the absolute time abstime,
+   measured against CLOCK_REALTIME.
+
+   Return value
+
+   BUFFER_OK on success, BUFFER_TIMEDOUT if the deadline passed first,
+   BUFFER_CLOSED as for buffer_put() and buffer_get().
+*/
+int buffer_timed_put(buffer_t *buffer, int a, int b, const struct timespec *abstime);
+int buffer_timed_get(buffer_t *buffer, tuple_t *tuple, const struct timespec *abstime);
+
+/* buffer_reserve_put(buffer)
+
+   Waits for a free slot and returns a pointer to it. The caller writes the
+   element in place and then publishes it with buffer_commit_put(buffer, slot).
+   A thread may hold one put reservation at a time. In the default (locked)
+   buffer the reservation holds the buffer's mutex until it is committed.
+   Returns NULL if the buffer is closed.
+*/
+void *buffer_reserve_put(buffer_t *buffer);
+void buffer_commit_put(buffer_t *buffer, void *slot);
+
+/* buffer_reserve_get(buffer)
+
+   Waits for an element and returns a pointer to its slot. The caller reads
+   the element in place and then frees the slot with
+   buffer_commit_get(buffer, slot). A thread may hold one get reservation at a
+   time. In the default (locked) buffer the reservation holds the buffer's
+   mutex until it is committed. Returns NULL if the buffer is closed and has
+   no elements left.
+*/
+const void *buffer_reserve_get(buffer_t *buffer);
+void buffer_commit_get(buffer_t *buffer, const void *slot);
+
+/* buffer_put_elem(buffer, elem)
+   buffer_get_elem(buffer, elem)
+
+   Copy one element of the buffer's element size into or out of the buffer.
+
+   Return value
+
+   BUFFER_OK or BUFFER_CLOSED, as for buffer_put() and buffer_get().
+*/
+int buffer_put_elem(buffer_t *buffer, const void *elem);
+int buffer_get_elem(buffer_t *buffer, void *elem);
+
+/* buffer_put_n(buffer, tuples, n)
+
+   Puts up to n tuples from the tuples array into the buffer in order, using a
+   single acquisition of the buffer. Blocks until there is room for at least
+   one tuple and then puts as many as fit.
+
+   Return value
+
+   The number of tuples put, between 1 and n (0 if n <= 0), or BUFFER_CLOSED
+   if the buffer was closed.
+*/
+int buffer_put_n(buffer_t *buffer, const tuple_t *tuples, int n);
+
+/* buffer_get_n(buffer, tuples, n)
+
+   Gets up to n tuples from the buffer into the tuples array in order, using a
+   single acquisition of the buffer. Blocks until there is at least one tuple
+   and then gets as many as are available.
+
+   Return value
+
+   The number of tuples read, between 1 and n (0 if n <= 0), or BUFFER_CLOSED
+   if the buffer was closed and no tuples were left.
+*/
+int buffer_get_n(buffer_t *buffer, tuple_t *tuples, int n);
+
+/* buffer_set_spin_max(buffer, spin_max)
+
+   Sets the largest number of iterations a thread of a BUFFER_ADAPTIVE buffer
+   spins before parking. The budget adjusts itself between a small minimum and
+   this limit. Setting a low limit favors CPU time over wake-up latency.
+*/
+void buffer_set_spin_max(buffer_t *buffer, int spin_max);
+
+/* buffer_wait_stats(buffer, stats)
+
+   Reads the spin and park counters and the current spin budgets of a
+   BUFFER_ADAPTIVE buffer into stats. The counters are updated with relaxed
+   atomics and may be slightly out of date while the buffer is in use.
+*/
+void buffer_wait_stats(buffer_t *buffer, buffer_wait_stats_t *stats);
+
+/* buffer_stats(buffer, stats)
+
+   Merges the per-thread counters of a BUFFER_STATS buffer into stats. Each
+   thread only ever updates counters of its own, so keeping statistics does
+   not add contention between threads. Counters of running threads are read
+   with relaxed atomics and may be slightly out of date. Occupancy is sampled
+   without synchronization and is approximate while the buffer is in use.
+
+   A buffer keeping statistics uses one pthread key, of which there is a
+   limited number (PTHREAD_KEYS_MAX) per process.
+*/
+void buffer_stats(buffer_t *buffer, buffer_stats_t *stats);
+
+/* buffer_stats_print(buffer)
+
+   Prints the statistics of a BUFFER_STATS buffer.
+*/
+void buffer_stats_print(buffer_t *buffer);
+
+#endif
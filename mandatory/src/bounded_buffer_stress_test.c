@@ -1,19 +1,27 @@
 #include "bounded_buffer.h"
+#include "sharded_buffer.h"
 
-#include <string.h>  // strncmp()
+#include <string.h>  // strncmp(), strcmp()
 #include <stdbool.h> // true, false
 #include <assert.h>  // assert()
 #include <ctype.h>   // isprint()
 #include <stddef.h>  // NULL
 #include <stdio.h>   // printf(), fprintf()
-#include <stdlib.h>  // [s]rand()
+#include <stdlib.h>  // [s]rand(), strtol()
+#include <errno.h>   // errno
+#include <limits.h>  // INT_MAX
 #include <unistd.h>  // usleep(), sleep()
 #include <pthread.h> // pthread_...
 
+#include "timing.h"  // timing_start(), timing_stop()
+#include "placement.h" // placement_t
+
 typedef struct {
   int id;
   int n;
+  int batch;
   buffer_t *buffer;
+  sbuffer_t *sbuffer;  // Used instead of buffer with -l.
 } producer_arg_t;
 
 typedef struct {
@@ -24,25 +32,117 @@ typedef struct {
 typedef struct {
   int id;
   int n;
+  int batch;
   buffer_t *buffer;
+  sbuffer_t *sbuffer;  // Used instead of buffer with -l.
   int num_producers;
   int *tuple_counters;
 } consumer_arg_t;
 
 bool verbose = false;
 
+/* Microseconds each producer and consumer sleeps before every put and get.
+   Zero skips the sleep, as even usleep(0) sleeps for the timer slack. */
+int think_time = 100;
+
+/* Close the buffer once all producers are done, and let consumers get until
+   the buffer is drained instead of a fixed number of items each. */
+bool close_mode = false;
+
+/* Number of lanes of a sharded buffer, 0 for a single bounded buffer. */
+int lanes = 0;
+
+/* CPUs of the producers, followed by those of the consumers. */
+placement_t placement;
+
+/* Creates thread i of n on its CPU. */
+void create_thread(pthread_t *tid, int i, int n, void *(*start_routine)(void *), void *arg) {
+  pthread_attr_t attr;
+
+  if (pthread_attr_init(&attr) != 0) {
+    perror("pthread_attr_init()");
+    abort();
+  }
+
+  placement_attr(&placement, &attr, i, n);
+
+  if (pthread_create(tid, &attr, start_routine, arg) != 0) {
+    perror("pthread_create()");
+    abort();
+  }
+  pthread_attr_destroy(&attr);
+}
+
+int put(buffer_t *buffer, sbuffer_t *sbuffer, int a, int b) {
+  return (sbuffer != NULL) ? sbuffer_put(sbuffer, a, b) : buffer_put(buffer, a, b);
+}
+
+int get(buffer_t *buffer, sbuffer_t *sbuffer, tuple_t *tuple) {
+  return (sbuffer != NULL) ? sbuffer_get(sbuffer, tuple) : buffer_get(buffer, tuple);
+}
+
 void *producer(void *arg) {
   producer_arg_t *a = (producer_arg_t *) arg;
 
+  if (a->batch > 1) {
+    tuple_t *tuples = malloc(a->batch*sizeof(tuple_t));
+    bool closed = false;
+
+    for (int i = 0; i < a->n && !closed; ) {
+      int k = (a->n - i < a->batch) ? a->n - i : a->batch;
+
+      for (int j = 0; j < k; j++) {
+        tuples[j].a = a->id;
+        tuples[j].b = i + j;
+        if (verbose) printf("P%03d (%d, %d)\n", a->id, a->id, i + j);
+      }
+
+      if (think_time > 0) usleep(think_time);
+
+      for (int done = 0; done < k && !closed; ) {
+        int put_now = buffer_put_n(a->buffer, tuples + done, k - done);
+
+        if (put_now < 0) {
+          closed = true;  // BUFFER_CLOSED, the rest can never be put.
+        } else {
+          done += put_now;
+        }
+      }
+      i += k;
+    }
+
+    free(tuples);
+    pthread_exit(0);
+  }
+
   for (int i = 0; i < a -> n; i++) {
     if (verbose) printf("P%03d (%d, %d)\n", a->id, a->id, i);
-    usleep(100);
-    buffer_put(a -> buffer, a->id, i);
+    if (think_time > 0) usleep(think_time);
+    put(a->buffer, a->sbuffer, a->id, i);
   }
 
   pthread_exit(0);
 }
 
+/* Check that tuple is the next in sequence from its producer. */
+void check(consumer_arg_t *a, stat_t *stats, tuple_t tuple) {
+  if (verbose) printf("C%03d (%d, %d)\n", a->id, tuple.a, tuple.b);
+
+  if (stats[tuple.a].last_value < tuple.b) {
+    stats[tuple.a].n = stats[tuple.a].n + 1;
+    stats[tuple.a].last_value = tuple.b;
+
+  } else {
+    printf("C%03d (%d, %d) when expecting (%d, X > %d)  ==> ERROR out of sequence\n",
+           a -> id,
+           tuple.a,
+           tuple.b,
+           tuple.a,
+           stats[tuple.a].last_value);
+    exit(EXIT_FAILURE);
+  }
+}
+
 void *consumer(void *arg) {
 
   consumer_arg_t *a = (consumer_arg_t *) arg;
@@ -56,26 +156,51 @@ void *consumer(void *arg) {
 
   tuple_t tuple;
 
-  for (int i = 0; i < a->n; i++) {
-    usleep(100);
-    buffer_get(a->buffer, &tuple);
+  if (close_mode) {
+    tuple_t *tuples = malloc(a->batch*sizeof(tuple_t));
 
-    if (verbose) printf("C%03d (%d, %d)\n", a->id, tuple.a, tuple.b);
+    for (;;) {
+      int k;
 
-    if (stats[tuple.a].last_value < tuple.b) {
-      stats[tuple.a].n = stats[tuple.a].n + 1;
-      stats[tuple.a].last_value = tuple.b;
+      if (think_time > 0) usleep(think_time);
 
-    } else {
-      printf("C%03d (%d, %d) when expecting (%d, X > %d)  ==> ERROR out of sequence\n",
-             a -> id,
-             tuple.a,
-             tuple.b,
-             tuple.a,
-             stats[tuple.a].last_value);
-      exit(EXIT_FAILURE);
+      if (a->batch > 1) {
+        k = buffer_get_n(a->buffer, tuples, a->batch);
+      } else {
+        k = (get(a->buffer, a->sbuffer, tuples) == BUFFER_OK) ? 1 : BUFFER_CLOSED;
+      }
+
+      if (k == BUFFER_CLOSED) break;
+
+      for (int j = 0; j < k; j++) {
+        check(a, stats, tuples[j]);
+      }
+    }
+
+    free(tuples);
+
+  } else if (a->batch > 1) {
+    tuple_t *tuples = malloc(a->batch*sizeof(tuple_t));
+
+    for (int i = 0; i < a->n; ) {
+      int k = (a->n - i < a->batch) ? a->n - i : a->batch;
+
+      if (think_time > 0) usleep(think_time);
+      k = buffer_get_n(a->buffer, tuples, k);
+
+      for (int j = 0; j < k; j++) {
+        check(a, stats, tuples[j]);
+      }
+      i += k;
     }
 
+    free(tuples);
+  }
+
+  for (int i = 0; !close_mode && a->batch <= 1 && i < a->n; i++) {
+    if (think_time > 0) usleep(think_time);
+    get(a->buffer, a->sbuffer, &tuple);
+    check(a, stats, tuple);
   }
 
   int tuple_count = 0;
@@ -84,16 +209,27 @@ void *consumer(void *arg) {
     tuple_count += stats[i].n;
   }
 
-  assert(tuple_count == a->n);
+  if (!close_mode) {
+    assert(tuple_count == a->n);
+  }
+
+  a->tuple_counters[a->id] = tuple_count;
+  free(stats);
   pthread_exit(0);
 }
 
 
-void test(int buffer_size, int num_producers, int n, int num_consumers, int m){
+void test(int buffer_size, int flags, int batch, int num_producers, int n, int num_consumers, int m){
   pthread_t *producers, *consumers;
 
   buffer_t buffer;
-  buffer_init(&buffer, buffer_size);
+  sbuffer_t sbuffer;
+
+  if (lanes > 0) {
+    sbuffer_init(&sbuffer, lanes, buffer_size, flags);
+  } else {
+    buffer_init_flags(&buffer, buffer_size, flags);
+  }
 
 
   producers = malloc(num_producers * sizeof(pthread_t));
@@ -111,18 +247,20 @@ void test(int buffer_size, int num_producers, int n, int num_consumers, int m){
     exit(EXIT_FAILURE);
   }
 
+  struct timespec start;
+  timing_start(&start);
+
   producer_arg_t arg[num_producers];
 
   for (int i = 0; i < num_producers; i++) {
 
     arg[i].id = i;
     arg[i].n    = n;
+    arg[i].batch = batch;
     arg[i].buffer = &buffer;
+    arg[i].sbuffer = (lanes > 0) ? &sbuffer : NULL;
 
-    if (pthread_create(&producers[i], NULL, producer, &arg[i]) != 0) {
-      perror("pthread_create()");
-      abort();
-    }
+    create_thread(&producers[i], i, num_producers + num_consumers, producer, &arg[i]);
   }
 
   consumer_arg_t carg[num_consumers];
@@ -130,14 +268,13 @@ void test(int buffer_size, int num_producers, int n, int num_consumers, int m){
   for (int i = 0; i < num_consumers; i++) {
     carg[i].id = i;
     carg[i].n  = m;
+    carg[i].batch = batch;
     carg[i].buffer = &buffer;
+    carg[i].sbuffer = (lanes > 0) ? &sbuffer : NULL;
     carg[i].num_producers = num_producers;
     carg[i].tuple_counters = tuple_counters;
 
-    if (pthread_create(&consumers[i], NULL, consumer, &carg[i]) != 0) {
-      perror("pthread_create()");
-      abort();
-    }
+    create_thread(&consumers[i], num_producers + i, num_producers + num_consumers, consumer, &carg[i]);
   }
 
 
@@ -149,23 +286,79 @@ void test(int buffer_size, int num_producers, int n, int num_consumers, int m){
     }
   }
 
+  if (close_mode && lanes > 0) {
+    sbuffer_close(&sbuffer);
+  } else if (close_mode) {
+    buffer_close(&buffer);
+  }
+
+  int consumed = 0;
+
   for (int i = 0; i < num_consumers; i++) {
     if ( pthread_join(consumers[i], NULL) != 0 ) {
       perror("couldn't join with  thread");
       exit(EXIT_FAILURE);
     }
 
+    consumed += tuple_counters[i];
   }
 
+  assert(consumed == (close_mode ? num_producers*n : num_consumers*m));
+
+
+  double elapsed = timing_stop(&start);
+
+  // Only prints with make TRACE=y.
+  psem_trace_print();
 
-  assert(num_producers*n % buffer.size == buffer.in);
-  assert(num_consumers*m % buffer.size == buffer.out);
-  assert(buffer.in == buffer.out);
+  if (lanes > 0) {
+    printf("\nThe buffer lanes when the test ends.\n");
+
+    sbuffer_print(&sbuffer);
+
+    printf("Elapsed time: %.4f s (%.4e items/s)\n", elapsed, consumed / elapsed);
+
+    for (int i = 0; (flags & BUFFER_STATS) && i < lanes; i++) {
+      printf("\nLane %d:\n", i);
+      buffer_stats_print(&sbuffer.lanes[i]);
+    }
+
+    sbuffer_destroy(&sbuffer);
+
+    puts("\n====> TEST SUCCESS <====\n");
+    return;
+  }
+
+  if (flags & BUFFER_MPMC) {
+    // Closing marks head, see buffer_close().
+    assert(close_mode || atomic_load(&buffer.head) == (size_t) num_producers*n);
+    assert(atomic_load(&buffer.tail) == (size_t) consumed);
+  } else {
+    assert(num_producers*n % buffer.size == buffer.in);
+    assert(consumed % buffer.size == buffer.out);
+    assert(buffer.in == buffer.out);
+  }
 
   printf("\nThe buffer when the test ends.\n");
 
   buffer_print(&buffer);
 
+  printf("Elapsed time: %.4f s (%.4e items/s)\n", elapsed, consumed / elapsed);
+
+  if (flags & BUFFER_STATS) {
+    buffer_stats_print(&buffer);
+  }
+
+  if (flags & BUFFER_ADAPTIVE) {
+    buffer_wait_stats_t stats;
+    buffer_wait_stats(&buffer, &stats);
+
+    printf("\nProducers: %zu spins, %zu parks, spin budget %d\n",
+           stats.put_spins, stats.put_parks, stats.put_budget);
+    printf("Consumers: %zu spins, %zu parks, spin budget %d\n",
+           stats.get_spins, stats.get_parks, stats.get_budget);
+  }
+
   puts("\n====> TEST SUCCESS <====\n");
 }
 
@@ -178,6 +371,21 @@ int optvalue(char opt, char *optarg, int default_value) {
   return (tmp != 0) ? tmp : default_value;
 }
 
+/* Value of an option that may be 0 but nothing less, such as a think time.
+   Rejects anything but a whole number in range, terminating the program. */
+int optvalue_nonnegative(char opt, char *optarg) {
+  char *end;
+
+  errno = 0;
+  long tmp = strtol(optarg, &end, 10);
+
+  if (end == optarg || *end != '\0' || errno != 0 || tmp < 0 || tmp > INT_MAX) {
+    fprintf(stderr, "Option -%c: invalid value %s, must be a number from 0.\n", opt, optarg);
+    exit(EXIT_FAILURE);
+  }
+  return (int) tmp;
+}
+
 int num_of_digits(int num) {
   int n = 0;
   while(num != 0)
@@ -191,13 +399,28 @@ int num_of_digits(int num) {
   return n;
 }
 
+/* Buffer flags for the synchronization strategy named by the -b option. */
+int buffer_flags(char *name) {
+  if (strcmp(name, "locked") == 0) return 0;
+  if (strcmp(name, "spsc") == 0) return BUFFER_SPSC;
+  if (strcmp(name, "mpmc") == 0) return BUFFER_MPMC;
+
+  printf("Option -b: unknown buffer type %s, will use default locked.\n", name);
+  return 0;
+}
+
 int main(int argc, char *argv[]) {
 
   int s = 10, p = 20, n = 10000, c = 20, m = 10000;
 
+  int flags = 0;
+  int batch = 1;
+  char *type = "locked";
+  char *placement_name = "none";
+
   int opt;
 
-  while((opt = getopt(argc, argv, ":s:p:n:c:m:v")) != -1)
+  while((opt = getopt(argc, argv, ":s:p:n:c:m:b:B:l:u:a:ACPSv")) != -1)
     {
       switch(opt)
         {
@@ -219,6 +442,37 @@ int main(int argc, char *argv[]) {
         case 'm':
           m = optvalue(opt, optarg, m);
           break;
+        case 'P':
+          flags |= BUFFER_POW2;
+          break;
+        case 'A':
+          flags |= BUFFER_ADAPTIVE;
+          break;
+        case 'S':
+          flags |= BUFFER_STATS;
+          break;
+        case 'C':
+          close_mode = true;
+          break;
+        case 'u':
+          think_time = optvalue_nonnegative(opt, optarg);
+          break;
+        case 'B':
+          batch = optvalue(opt, optarg, batch);
+          break;
+        case 'l':
+          lanes = optvalue(opt, optarg, lanes);
+          break;
+        case 'a':
+          placement_name = optarg;
+          break;
+        case 'b': {
+          int bf = buffer_flags(optarg);
+
+          flags = (flags & (BUFFER_POW2 | BUFFER_ADAPTIVE | BUFFER_STATS)) | bf;
+          type = (bf == 0) ? "locked" : optarg;
+          break;
+        }
          case ':':
           printf("option %c needs a value\n", opt);
           break;
@@ -237,17 +491,55 @@ int main(int argc, char *argv[]) {
   int w1 = (wp > wc) ? wp : wc;
   int w2 = (wn > wm) ? wn : wm;
 
-  printf("Test buffer of size %d with: \n\n", s);
+  if (!placement_init(&placement, placement_name)) {
+    exit(EXIT_FAILURE);
+  }
+
+  if ((flags & BUFFER_SPSC) && (p != 1 || c != 1)) {
+    printf("Buffer type spsc requires exactly one producer and one consumer (-p 1 -c 1).\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (lanes > 0 && (flags & BUFFER_SPSC)) {
+    printf("Buffer type spsc cannot be used for the lanes of a sharded buffer (-l).\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (lanes > 0 && batch > 1) {
+    printf("Batches are not supported by sharded buffers (-l), will use -B 1.\n");
+    batch = 1;
+  }
+
+  if (lanes > 0) {
+    printf("Test sharded buffer of %d lanes of size %d with: \n\n", lanes, s);
+  } else {
+    printf("Test %s buffer of size %d with: \n\n", type, s);
+  }
   printf(" %*d producers, each producing %*d items.\n", w1, p, w2, n);
-  printf(" %*d consumers, each consuming %*d items.\n", w1, c, w2, m);
+  if (close_mode) {
+    printf(" %*d consumers, consuming until the buffer is closed and drained.\n", w1, c);
+  } else {
+    printf(" %*d consumers, each consuming %*d items.\n", w1, c, w2, m);
+  }
 
-  if (p*n != c*m) {
+  if (!close_mode && p*n != c*m) {
     printf("\nWarning: total number of produced items (%d*%d = %d) not equal to the\n", p, n, p*n);
     printf("         total number of consumed items (%d*%d = %d).\n", c, m, c*m);
   }
 
+  if (batch > 1) {
+    printf("\nBatches of up to %d items per put and get.\n", batch);
+  }
+
+  printf("\nThink time: %d us per put and get.\n", think_time);
+  printf("Power of two layout: %s\n", (flags & BUFFER_POW2) ? "true" : "false");
+  printf("Adaptive waiting: %s\n", (flags & BUFFER_ADAPTIVE) ? "true" : "false");
+  placement_print(&placement, p + c);
+
   printf("\nVerbose: %s\n", verbose ? "true" : "false");
 
-  test(s, p, n, c, m);
+  test(s, flags, batch, p, n, c, m);
+
+  placement_destroy(&placement);
 
 }
@@ -15,6 +15,8 @@
 #include <unistd.h>  // usleep(), sleep()
 #include <pthread.h> // pthread_.. 
 #include <assert.h>  // assert()
+#include <string.h>  // strcmp()
+#include <sys/wait.h> // waitpid()
 
 #define TEST_HEADER printf("\n==== %s ====\n\n", __FUNCTION__)
 
@@ -134,6 +136,519 @@ void get_test() {
   success();
 }
 
+void spsc_test() {
+  TEST_HEADER;
+
+  buffer_t buffer;
+  tuple_t tuple;
+
+  buffer_init_flags(&buffer, 3, BUFFER_SPSC);
+
+  produce(&buffer, 1, 111);
+  produce(&buffer, 2, 222);
+  produce(&buffer, 3, 333);
+
+  assert(buffer.array[0].a == 1 && buffer.array[0].b == 111);
+  assert(buffer.array[2].a == 3 && buffer.array[2].b == 333);
+
+  consume(&buffer, &tuple);
+  assert(tuple.a == 1 && tuple.b == 111);
+
+  produce(&buffer, 4, 444);
+  assert(buffer.in == 1);
+
+  consume(&buffer, &tuple);
+  assert(tuple.a == 2 && tuple.b == 222);
+
+  consume(&buffer, &tuple);
+  assert(tuple.a == 3 && tuple.b == 333);
+
+  consume(&buffer, &tuple);
+  assert(tuple.a == 4 && tuple.b == 444);
+  assert(buffer.in == buffer.out);
+
+  buffer_destroy(&buffer);
+
+  success();
+}
+
+void mpmc_test() {
+  TEST_HEADER;
+
+  buffer_t buffer;
+  tuple_t tuple;
+
+  buffer_init_flags(&buffer, 3, BUFFER_MPMC);
+
+  assert(buffer.seq != NULL);
+
+  produce(&buffer, 1, 111);
+  produce(&buffer, 2, 222);
+  produce(&buffer, 3, 333);
+
+  consume(&buffer, &tuple);
+  assert(tuple.a == 1 && tuple.b == 111);
+
+  produce(&buffer, 4, 444);
+
+  // Slot 0 is now one lap ahead.
+  assert(buffer.array[0].a == 4 && buffer.array[0].b == 444);
+  assert(atomic_load(&buffer.seq[0]) == 4);
+
+  consume(&buffer, &tuple);
+  assert(tuple.a == 2 && tuple.b == 222);
+
+  consume(&buffer, &tuple);
+  assert(tuple.a == 3 && tuple.b == 333);
+
+  consume(&buffer, &tuple);
+  assert(tuple.a == 4 && tuple.b == 444);
+
+  buffer_destroy(&buffer);
+  assert(buffer.seq == NULL);
+
+  success();
+}
+
+void batch_test_flags(int flags) {
+  buffer_t buffer;
+  tuple_t tuples[4] = {{1, 111}, {2, 222}, {3, 333}, {4, 444}};
+  tuple_t out[4];
+
+  buffer_init_flags(&buffer, 3, flags);
+
+  // Only three of the four tuples fit.
+  assert(buffer_put_n(&buffer, tuples, 4) == 3);
+
+  assert(buffer_get_n(&buffer, out, 2) == 2);
+  assert(out[0].a == 1 && out[1].a == 2);
+
+  // Wraps around the end of the array.
+  assert(buffer_put_n(&buffer, tuples + 3, 1) == 1);
+
+  // Only two tuples are available.
+  assert(buffer_get_n(&buffer, out, 4) == 2);
+  assert(out[0].a == 3 && out[0].b == 333);
+  assert(out[1].a == 4 && out[1].b == 444);
+
+  assert(buffer_put_n(&buffer, tuples, 0) == 0);
+
+  buffer_destroy(&buffer);
+}
+
+void batch_test() {
+  TEST_HEADER;
+
+  batch_test_flags(0);
+  batch_test_flags(BUFFER_SPSC);
+  batch_test_flags(BUFFER_MPMC);
+
+  success();
+}
+
+/* Absolute CLOCK_REALTIME time ms milliseconds from now. */
+struct timespec deadline_ms(int ms) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+
+  ts.tv_nsec += (ms % 1000) * 1000000L;
+  ts.tv_sec  += ms / 1000 + ts.tv_nsec / 1000000000L;
+  ts.tv_nsec %= 1000000000L;
+
+  return ts;
+}
+
+void try_timed_test_flags(int flags) {
+  buffer_t buffer;
+  tuple_t tuple;
+  struct timespec deadline;
+
+  buffer_init_flags(&buffer, 2, flags);
+
+  assert(buffer_try_get(&buffer, &tuple) == BUFFER_WOULDBLOCK);
+
+  assert(buffer_try_put(&buffer, 1, 111) == BUFFER_OK);
+  assert(buffer_try_put(&buffer, 2, 222) == BUFFER_OK);
+  assert(buffer_try_put(&buffer, 3, 333) == BUFFER_WOULDBLOCK);
+
+  deadline = deadline_ms(50);
+  assert(buffer_timed_put(&buffer, 3, 333, &deadline) == BUFFER_TIMEDOUT);
+
+  deadline = deadline_ms(50);
+  assert(buffer_timed_get(&buffer, &tuple, &deadline) == BUFFER_OK);
+  assert(tuple.a == 1 && tuple.b == 111);
+
+  assert(buffer_try_get(&buffer, &tuple) == BUFFER_OK);
+  assert(tuple.a == 2 && tuple.b == 222);
+
+  deadline = deadline_ms(50);
+  assert(buffer_timed_get(&buffer, &tuple, &deadline) == BUFFER_TIMEDOUT);
+
+  // Nor do they wait for the mutex of a locked buffer, held here across a
+  // reservation.
+  if (!(flags & (BUFFER_SPSC | BUFFER_MPMC))) {
+    assert(buffer_try_put(&buffer, 4, 444) == BUFFER_OK);
+
+    tuple_t *slot = buffer_reserve_put(&buffer);
+
+    assert(buffer_try_get(&buffer, &tuple) == BUFFER_WOULDBLOCK);
+    deadline = deadline_ms(50);
+    assert(buffer_timed_get(&buffer, &tuple, &deadline) == BUFFER_TIMEDOUT);
+
+    *slot = (tuple_t) { 5, 555 };
+    buffer_commit_put(&buffer, slot);
+
+    assert(buffer_try_get(&buffer, &tuple) == BUFFER_OK);
+    assert(tuple.a == 4 && tuple.b == 444);
+    assert(buffer_try_get(&buffer, &tuple) == BUFFER_OK);
+    assert(tuple.a == 5 && tuple.b == 555);
+  }
+
+  buffer_destroy(&buffer);
+}
+
+void try_timed_test() {
+  TEST_HEADER;
+
+  try_timed_test_flags(0);
+  try_timed_test_flags(BUFFER_SPSC);
+  try_timed_test_flags(BUFFER_MPMC);
+  try_timed_test_flags(BUFFER_ADAPTIVE);
+  try_timed_test_flags(BUFFER_SPSC | BUFFER_ADAPTIVE);
+
+  success();
+}
+
+void *closed_getter(void *arg) {
+  buffer_t *buffer = (buffer_t*) arg;
+  tuple_t tuple;
+
+  assert(buffer_get(buffer, &tuple) == BUFFER_CLOSED);
+  pthread_exit(NULL);
+}
+
+void *closed_putter(void *arg) {
+  buffer_t *buffer = (buffer_t*) arg;
+
+  assert(buffer_put(buffer, 3, 333) == BUFFER_CLOSED);
+  pthread_exit(NULL);
+}
+
+void close_test_flags(int flags) {
+  pthread_t tid[2];
+  buffer_t buffer;
+  tuple_t tuple, tuples[4];
+  int threads = (flags & BUFFER_SPSC) ? 1 : 2;
+
+  // Getters waiting on an empty buffer are woken up by close.
+  buffer_init_flags(&buffer, 2, flags);
+
+  for (int i = 0; i < threads; i++) {
+    pthread_create(&tid[i], NULL, closed_getter, &buffer);
+  }
+  usleep(20000);
+  buffer_close(&buffer);
+
+  for (int i = 0; i < threads; i++) {
+    pthread_join(tid[i], NULL);
+  }
+  buffer_destroy(&buffer);
+
+  // Putters waiting on a full buffer are woken up by close, and the tuples
+  // already put can still be taken.
+  buffer_init_flags(&buffer, 2, flags);
+
+  assert(buffer_put(&buffer, 1, 111) == BUFFER_OK);
+  assert(buffer_put(&buffer, 2, 222) == BUFFER_OK);
+
+  for (int i = 0; i < threads; i++) {
+    pthread_create(&tid[i], NULL, closed_putter, &buffer);
+  }
+  usleep(20000);
+  buffer_close(&buffer);
+
+  for (int i = 0; i < threads; i++) {
+    pthread_join(tid[i], NULL);
+  }
+
+  assert(buffer_put(&buffer, 3, 333) == BUFFER_CLOSED);
+  assert(buffer_try_put(&buffer, 3, 333) == BUFFER_CLOSED);
+  assert(buffer_put_n(&buffer, tuples, 4) == BUFFER_CLOSED);
+  assert(buffer_reserve_put(&buffer) == NULL);
+
+  assert(buffer_get(&buffer, &tuple) == BUFFER_OK);
+  assert(tuple.a == 1 && tuple.b == 111);
+  assert(buffer_get_n(&buffer, tuples, 4) == 1);
+  assert(tuples[0].a == 2 && tuples[0].b == 222);
+
+  assert(buffer_get(&buffer, &tuple) == BUFFER_CLOSED);
+  assert(buffer_try_get(&buffer, &tuple) == BUFFER_CLOSED);
+  assert(buffer_get_n(&buffer, tuples, 4) == BUFFER_CLOSED);
+  assert(buffer_reserve_get(&buffer) == NULL);
+
+  buffer_close(&buffer);
+  assert(buffer_get(&buffer, &tuple) == BUFFER_CLOSED);
+
+  buffer_destroy(&buffer);
+}
+
+void close_test() {
+  TEST_HEADER;
+
+  close_test_flags(0);
+  close_test_flags(BUFFER_SPSC);
+  close_test_flags(BUFFER_SPSC | BUFFER_SPIN);
+  close_test_flags(BUFFER_MPMC);
+  close_test_flags(BUFFER_SPSC | BUFFER_ADAPTIVE);
+  close_test_flags(BUFFER_MPMC | BUFFER_ADAPTIVE);
+
+  success();
+}
+
+#define SHM_TUPLES 1000
+
+/* A child process puts tuples in place into a shared buffer and closes it,
+   the parent takes them out in place until the buffer is closed. */
+void shm_test_flags(int flags) {
+  char name[64];
+
+  snprintf(name, sizeof(name), "/bounded_buffer_test.%d", (int) getpid());
+
+  buffer_t *buffer = buffer_shm_create(name, 4, sizeof(tuple_t), _Alignof(tuple_t), flags);
+
+  assert(buffer->flags & BUFFER_SHARED);
+  assert(buffer->array == NULL && buffer->mutex == NULL);
+
+  pid_t pid = fork();
+
+  if (pid == -1) {
+    perror("fork()");
+    exit(EXIT_FAILURE);
+  }
+
+  if (pid == 0) {
+    buffer_t *child = buffer_shm_open(name);
+
+    for (int i = 0; i < SHM_TUPLES; i++) {
+      tuple_t *tuple = buffer_reserve_put(child);
+
+      tuple->a = getpid();
+      tuple->b = i;
+      buffer_commit_put(child, tuple);
+    }
+
+    buffer_close(child);
+    buffer_shm_close(child);
+    _exit(EXIT_SUCCESS);
+  }
+
+  const tuple_t *tuple;
+  int n = 0;
+
+  while ((tuple = buffer_reserve_get(buffer)) != NULL) {
+    assert(tuple->a == pid && tuple->b == n);
+    buffer_commit_get(buffer, tuple);
+    n++;
+  }
+
+  int status;
+
+  assert(waitpid(pid, &status, 0) == pid);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+  assert(n == SHM_TUPLES);
+
+  printf("flags %d: %d tuples from process %d\n", flags, n, (int) pid);
+
+  buffer_shm_close(buffer);
+  buffer_shm_unlink(name);
+}
+
+void shm_test() {
+  TEST_HEADER;
+
+  shm_test_flags(0);
+  shm_test_flags(BUFFER_SPSC);
+  shm_test_flags(BUFFER_MPMC);
+  shm_test_flags(BUFFER_SPSC | BUFFER_ADAPTIVE);
+
+  success();
+}
+
+void *slow_producer(void *arg) {
+  buffer_t *buffer = (buffer_t*) arg;
+
+  for (int i = 0; i < 20; i++) {
+    usleep(1000);
+    buffer_put(buffer, i, i*i);
+  }
+  pthread_exit(NULL);
+}
+
+void adaptive_test_flags(int flags) {
+  pthread_t tid;
+  buffer_t buffer;
+  tuple_t tuple;
+  buffer_wait_stats_t stats;
+
+  buffer_init_flags(&buffer, 4, flags | BUFFER_ADAPTIVE);
+  buffer_set_spin_max(&buffer, 64);
+
+  if (pthread_create(&tid, NULL, slow_producer, &buffer) != 0) {
+    perror("pthread_create()");
+    exit(EXIT_FAILURE);
+  }
+
+  // The producer is much slower than any spin budget, forcing parks.
+  for (int i = 0; i < 20; i++) {
+    buffer_get(&buffer, &tuple);
+    assert(tuple.a == i && tuple.b == i*i);
+  }
+
+  pthread_join(tid, NULL);
+
+  buffer_wait_stats(&buffer, &stats);
+  printf("flags %d: get spins %zu, get parks %zu, get budget %d\n",
+         flags, stats.get_spins, stats.get_parks, stats.get_budget);
+
+  assert(stats.get_parks > 0);
+  assert(stats.get_budget <= 64);
+
+  buffer_destroy(&buffer);
+}
+
+void adaptive_test() {
+  TEST_HEADER;
+
+  adaptive_test_flags(0);
+  adaptive_test_flags(BUFFER_SPSC);
+  adaptive_test_flags(BUFFER_MPMC);
+
+  success();
+}
+
+void *stats_consumer(void *arg) {
+  buffer_t *buffer = (buffer_t*) arg;
+  tuple_t tuple;
+
+  for (int i = 0; i < 4; i++) {
+    buffer_get(buffer, &tuple);
+  }
+  pthread_exit(NULL);
+}
+
+void stats_test_flags(int flags) {
+  pthread_t tid;
+  buffer_t buffer;
+  buffer_stats_t stats;
+  tuple_t tuple, tuples[3];
+
+  buffer_init_flags(&buffer, 4, flags | BUFFER_STATS);
+
+  for (int i = 0; i < 4; i++) {
+    buffer_put(&buffer, i, i);
+  }
+
+  buffer_get(&buffer, &tuple);
+  assert(buffer_get_n(&buffer, tuples, 3) == 3);
+
+  // The consumer waits on the empty buffer until the puts below.
+  if (pthread_create(&tid, NULL, stats_consumer, &buffer) != 0) {
+    perror("pthread_create()");
+    exit(EXIT_FAILURE);
+  }
+
+  for (int i = 0; i < 4; i++) {
+    usleep(10000);
+    buffer_put(&buffer, i, i);
+  }
+
+  pthread_join(tid, NULL);
+
+  buffer_stats(&buffer, &stats);
+  buffer_stats_print(&buffer);
+
+  assert(stats.puts == 8);
+  assert(stats.gets == 8);
+  assert(stats.high_water == 4);
+  // The full buffer was seen at least once.
+  assert(stats.occupancy[4 * BUFFER_STATS_BUCKETS / 5] >= 1);
+  assert(stats.empty_waits >= 1 && stats.empty_time > 0.0);
+  assert(stats.full_waits == 0);
+
+  size_t samples = 0;
+  for (int i = 0; i < BUFFER_STATS_BUCKETS; i++) {
+    samples += stats.occupancy[i];
+  }
+  assert(samples == 4 + 2 + 4 + 4);
+
+  buffer_destroy(&buffer);
+}
+
+void stats_test() {
+  TEST_HEADER;
+
+  stats_test_flags(0);
+  stats_test_flags(BUFFER_SPSC);
+  stats_test_flags(BUFFER_MPMC);
+
+  success();
+}
+
+typedef struct {
+  long id;
+  double value;
+  char tag[8];
+} record_t;
+
+void elem_test_flags(int flags) {
+  buffer_t buffer;
+  record_t record;
+
+  buffer_init_elem(&buffer, 3, sizeof(record_t), _Alignof(record_t), flags);
+
+  // 24 byte records are padded to 32 bytes, two per cache line.
+  assert(buffer.elem_size == sizeof(record_t));
+  assert(buffer.stride == 32);
+  assert((size_t) buffer.slots % CACHE_LINE_SIZE == 0);
+
+  // Build records in place.
+  for (int i = 0; i < 3; i++) {
+    record_t *slot = buffer_reserve_put(&buffer);
+    slot->id = i;
+    slot->value = i * 1.5;
+    snprintf(slot->tag, sizeof(slot->tag), "r%d", i);
+    buffer_commit_put(&buffer, slot);
+  }
+
+  // Read the first record in place.
+  const record_t *slot = buffer_reserve_get(&buffer);
+  assert(slot->id == 0 && slot->value == 0.0);
+  buffer_commit_get(&buffer, slot);
+
+  // Copy in and out, wrapping around.
+  record_t r3 = {3, 4.5, "r3"};
+  buffer_put_elem(&buffer, &r3);
+
+  for (int i = 1; i < 4; i++) {
+    buffer_get_elem(&buffer, &record);
+    assert(record.id == i && record.value == i * 1.5);
+  }
+  assert(strcmp(record.tag, "r3") == 0);
+
+  buffer_destroy(&buffer);
+}
+
+void elem_test() {
+  TEST_HEADER;
+
+  elem_test_flags(0);
+  elem_test_flags(BUFFER_SPSC);
+  elem_test_flags(BUFFER_MPMC);
+
+  success();
+}
+
 void random_ms_sleep(int min, int max) {
   usleep(1000 * (rand() % (max + 1 - min) + min));
 }
@@ -212,5 +727,14 @@ int main(void) {
   print_test();
   put_test();
   get_test();
+  spsc_test();
+  mpmc_test();
+  batch_test();
+  try_timed_test();
+  close_test();
+  shm_test();
+  elem_test();
+  adaptive_test();
+  stats_test();
   concurrent_put_get_test();
 }
@@ -0,0 +1,72 @@
+#include "histogram.h"
+
+#include <stdio.h>  // perror()
+#include <stdlib.h> // malloc(), exit()
+#include <string.h> // memset()
+
+histogram_t *histogram_init(void) {
+  histogram_t *h = malloc(sizeof(histogram_t));
+
+  if (h == NULL) {
+    perror("Could not allocate histogram");
+    exit(EXIT_FAILURE);
+  }
+
+  histogram_init_at(h);
+  return h;
+}
+
+void histogram_init_at(histogram_t *h) {
+  memset(h, 0, sizeof(histogram_t));
+}
+
+void histogram_destroy(histogram_t *h) {
+  free(h);
+}
+
+void histogram_merge(histogram_t *into, const histogram_t *from) {
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    into->buckets[i] += from->buckets[i];
+  }
+  into->count += from->count;
+
+  if (from->max > into->max) {
+    into->max = from->max;
+  }
+}
+
+/* The largest value counted in bucket i. */
+static uint64_t highest_in(int i) {
+  if (i < HISTOGRAM_SUB_BUCKETS) {
+    return i;
+  }
+
+  int shift = i / HISTOGRAM_SUB_BUCKETS - 1;
+  uint64_t first = (uint64_t) (HISTOGRAM_SUB_BUCKETS + i % HISTOGRAM_SUB_BUCKETS) << shift;
+
+  return first + ((uint64_t) 1 << shift) - 1;
+}
+
+uint64_t histogram_percentile(const histogram_t *h, double percentile) {
+  if (h->count == 0) {
+    return 0;
+  }
+
+  // The rank of the value sought, from 1 to count.
+  uint64_t rank = (uint64_t) (percentile / 100 * h->count + 0.5);
+  uint64_t seen = 0;
+
+  if (rank < 1) rank = 1;
+  if (rank > h->count) rank = h->count;
+
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    seen += h->buckets[i];
+
+    if (seen >= rank) {
+      uint64_t value = highest_in(i);
+
+      return (value < h->max) ? value : h->max;
+    }
+  }
+  return h->max;
+}
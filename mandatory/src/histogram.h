@@ -0,0 +1,80 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h> // uint64_t
+
+/* A log-linear histogram of non-negative values, such as latencies in
+   nanoseconds, in the manner of HdrHistogram.
+
+   Values below 2^HISTOGRAM_PRECISION each have a bucket of their own. Above
+   that, every power of two is split into 2^HISTOGRAM_PRECISION buckets of
+   equal width, so a value is kept with a relative error below
+   2^-HISTOGRAM_PRECISION, under 1%, over the whole 64-bit range.
+
+   Recording a value is a few instructions on memory private to the histogram,
+   so each thread keeps a histogram of its own and the histograms are merged
+   once the threads are done.
+*/
+
+#define HISTOGRAM_PRECISION 7
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_PRECISION)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_PRECISION + 1) * HISTOGRAM_SUB_BUCKETS)
+
+typedef struct {
+  uint64_t count;
+  uint64_t max;
+  uint64_t buckets[HISTOGRAM_BUCKETS];
+} histogram_t;
+
+/* histogram_init()
+   histogram_init_at(h)
+
+   Allocates an empty histogram, freed with histogram_destroy(), or empties
+   the histogram at h.
+*/
+histogram_t *histogram_init(void);
+void histogram_init_at(histogram_t *h);
+void histogram_destroy(histogram_t *h);
+
+/* The bucket of value, see above. */
+static inline int histogram_bucket(uint64_t value) {
+  if (value < HISTOGRAM_SUB_BUCKETS) {
+    return value;
+  }
+
+  int msb = 63 - __builtin_clzll(value);
+  int shift = msb - HISTOGRAM_PRECISION;
+
+  return (shift + 1) * HISTOGRAM_SUB_BUCKETS + (int) (value >> shift) - HISTOGRAM_SUB_BUCKETS;
+}
+
+/* histogram_record(h, value)
+
+   Counts value in the histogram at h.
+*/
+static inline void histogram_record(histogram_t *h, uint64_t value) {
+  h->buckets[histogram_bucket(value)]++;
+  h->count++;
+
+  if (value > h->max) {
+    h->max = value;
+  }
+}
+
+/* histogram_merge(into, from)
+
+   Adds the values counted in from to the histogram into.
+*/
+void histogram_merge(histogram_t *into, const histogram_t *from);
+
+/* histogram_percentile(h, percentile)
+
+   Return value
+
+   The smallest value, up to the width of its bucket, at or below which at
+   least percentile percent of the values counted in h are, but never more than
+   the largest value counted. 0 if h is empty.
+*/
+uint64_t histogram_percentile(const histogram_t *h, double percentile);
+
+#endif
@@ -11,33 +11,142 @@
  */
 
 #include <stdio.h>     // printf(), fprintf()
-#include <stdlib.h>    // abort()
+#include <stdlib.h>    // abort(), getenv(), atoi()
+#include <string.h>    // strcmp()
+#include <unistd.h>    // getopt()
 #include <pthread.h>   // pthread_...
 #include <stdbool.h>   // true, false
+#include <stdatomic.h> // atomic_...
+#include <sched.h>     // sched_yield()
+#include <stdint.h>    // uint64_t
+#include <limits.h>    // INT_MAX
+#include <time.h>      // clock_gettime()
 
 #include "timing.h"    // timing_start(), timing_stop()
+#include "histogram.h" // histogram_t
+#include "placement.h" // placement_t
+#include "psem.h"      // psem_t
+#include "plock.h"     // pticket_t
+#include "pcounter.h"  // pcounter_t
 
-/* Shared variable */
-volatile int counter;
+/* Size of a cache line, the unit in which processors share memory */
+#define CACHE_LINE 64
 
-/* Pthread mutex lock */
-pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Shared variable, alone in its cache line. See enum layout for the other
+ * places threads may keep the counter they update. */
+struct {
+    _Alignas(CACHE_LINE) volatile int value;
+} counter;
 
-/* Shared variable used to implement a spinlock */
-volatile int lock = false;
+/* Where the threads keep the counter: in the cache line of the lock word of
+ * the lock guarding it, in a cache line of its own, or sharded with a counter
+ * in a cache line of its own per thread that are summed at the end. Test
+ * cases without a lock word of their own to share use padded when asked for
+ * colocated. */
+enum layout {colocated, padded, sharded};
+
+const char *layout_names[] = { "colocated", "padded", "sharded" };
+
+enum layout layout = padded;
 
-/* Number of threads that will increment the shared variable */
-#define INC_THREADS 5
 /* Value by which the threads increment the shared variable */
 #define INCREMENT 2
-/* Iterations performed incrementing the shared variable */
+/* Value by which the threads decrement the shared variable */
+#define DECREMENT 2
+
+/* Defaults of the benchmark parameters below, see usage() */
+#define INC_THREADS 5
+#define DEC_THREADS 4
 #define INC_ITERATIONS 20000
+
+/* Number of threads that will increment the shared variable */
+int inc_threads = INC_THREADS;
 /* Number of threads that will try to decrement the shared variable */
-#define DEC_THREADS 4
-/* Value by which the threads increment the shared variable */
-#define DECREMENT 2
-/* Iterations performed decrementing the shared variable.*/
-#define DEC_ITERATIONS (INC_ITERATIONS * INC_THREADS * INCREMENT / DEC_THREADS / DECREMENT)
+int dec_threads = DEC_THREADS;
+/* Iterations performed incrementing the shared variable */
+int inc_iterations = INC_ITERATIONS;
+/* Iterations performed decrementing the shared variable, see balance() */
+int dec_iterations;
+/* Units of work done inside each critical section */
+int cs_work = 0;
+/* Units of work done between critical sections */
+int think_work = 0;
+/* Whether the threads time every operation, see latency_start() */
+bool record_latency = false;
+
+/* Busy work standing in for the rest of a critical section or for the code
+ * run between critical sections. */
+static inline void
+work(int units)
+{
+    for (volatile int i = 0; i < units; i++) {
+    }
+}
+
+/* Nanoseconds on the monotonic clock, for timing single operations. */
+static inline uint64_t
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Timing an operation takes two reads of the clock, which cost more than an
+ * atomic addition and would be counted in the throughput, so operations are
+ * only timed with -L. Without it latency_start() and latency_stop() read no
+ * clock. */
+static inline uint64_t
+latency_start(void)
+{
+    return record_latency ? now() : 0;
+}
+
+static inline void
+latency_stop(histogram_t *latency, uint64_t start)
+{
+    if (record_latency) {
+        histogram_record(latency, now() - start);
+    }
+}
+
+/*******************************************************************************
+                                Thread context
+*******************************************************************************/
+
+/* Every lock is used through the same lock/unlock vtable, so that one pair of
+ * thread functions serves them all. A thread passes its own context to each
+ * call, holding the queue nodes of the MCS and CLH locks. Every test case
+ * passes the context to its threads, which record their latencies in it. */
+
+typedef struct qnode {
+    _Alignas(CACHE_LINE) _Atomic(struct qnode *) next;  // MCS only.
+    atomic_bool locked;
+} qnode_t;
+
+struct lock_ops;
+
+typedef struct {
+    struct lock_ops *ops;  // The lock under test.
+    qnode_t mcs;           // Queue node of the thread for the MCS lock.
+    qnode_t *clh;          // Node the thread enqueues next for the CLH lock.
+    qnode_t *clh_pred;     // Node of the predecessor while holding the CLH lock.
+    histogram_t *latency;  // Nanoseconds taken by each acquisition of the lock,
+                           // or by each update of the counter without one,
+                           // with -L only.
+    volatile int *counter; // The counter the thread updates, see layout.
+    _Alignas(CACHE_LINE) volatile int shard;  // Counter of the thread when sharded.
+} lock_ctx_t;
+
+typedef struct lock_ops {
+    char *name;
+    void (*init)(lock_ctx_t *ctxs, int nthreads);  // Optional.
+    void (*lock)(lock_ctx_t *ctx);
+    void (*unlock)(lock_ctx_t *ctx);
+    void (*fini)(void);                            // Optional.
+    volatile int *colocated;  // Counter in the cache line of the lock word, if any.
+} lock_ops_t;
 
 /*******************************************************************************
                           Test 0 - No synchronization
@@ -45,12 +154,17 @@ volatile int lock = false;
 
 /* Unsynchronized increments of the shared counter variable */
 void *
-inc_no_sync(void *arg __attribute__((unused)))
+inc_no_sync(void *arg)
 {
+    lock_ctx_t *ctx = (lock_ctx_t *)arg;
     int i;
 
-    for (i = 0; i < INC_ITERATIONS; i++) {
-        counter += INCREMENT;
+    for (i = 0; i < inc_iterations; i++) {
+        uint64_t start = latency_start();
+        *ctx->counter += INCREMENT;
+        latency_stop(ctx->latency, start);
+        work(cs_work);
+        work(think_work);
     }
 
     return NULL;
@@ -58,132 +172,463 @@ inc_no_sync(void *arg __attribute__((unused)))
 
 /* Unsynchronized decrements of the shared counter variable */
 void *
-dec_no_sync(void *arg __attribute__((unused)))
+dec_no_sync(void *arg)
 {
+    lock_ctx_t *ctx = (lock_ctx_t *)arg;
     int i;
 
-    for (i = 0; i < DEC_ITERATIONS; i++) {
-        counter -= DECREMENT;
+    for (i = 0; i < dec_iterations; i++) {
+        uint64_t start = latency_start();
+        *ctx->counter -= DECREMENT;
+        latency_stop(ctx->latency, start);
+        work(cs_work);
+        work(think_work);
     }
 
     return NULL;
 }
 
 /*******************************************************************************
-                          Test 1 - Pthread mutex lock
+                      Test 1 - Atomic addition/subtraction
 *******************************************************************************/
 
-/* Increments of the shared counter should be protected by a mutex */
+/* Increment the shared counter using an atomic increment instruction */
 void *
-inc_mutex(void *arg __attribute__((unused)))
+inc_atomic(void *arg)
 {
+    lock_ctx_t *ctx = (lock_ctx_t *)arg;
     int i;
 
-    for (i = 0; i < INC_ITERATIONS; i++) {
-        /* TODO: Protect access to the shared variable counter with a mutex lock
-         * inside the loop. */
-        counter += INCREMENT;
+    for (i = 0; i < inc_iterations; i++) {
+        uint64_t start = latency_start();
+        __atomic_fetch_add(ctx->counter, INCREMENT, __ATOMIC_RELAXED);
+        latency_stop(ctx->latency, start);
+        work(cs_work);
+        work(think_work);
     }
 
     return NULL;
 }
 
-/* Decrements of the shared counter should be protected by a mutex */
+/* Decrement the shared counter using an atomic increment instruction */
 void *
-dec_mutex(void *arg __attribute__((unused)))
+dec_atomic(void *arg)
 {
+    lock_ctx_t *ctx = (lock_ctx_t *)arg;
     int i;
 
-    for (i = 0; i < DEC_ITERATIONS; i++) {
-        /* TODO: Protect access to the shared variable counter with a mutex lock
-         * inside the loop. */
-        counter -= DECREMENT;
+    for (i = 0; i < dec_iterations; i++) {
+        uint64_t start = latency_start();
+        __atomic_fetch_sub(ctx->counter, DECREMENT, __ATOMIC_RELAXED);
+        latency_stop(ctx->latency, start);
+        work(cs_work);
+        work(think_work);
     }
 
     return NULL;
 }
 
-
 /*******************************************************************************
-                      Test 2 - Spinlock with test-and-set
+                          Test 2 - Sharded counter
 *******************************************************************************/
 
-void spin_lock() {
-    /* TODO: Implement the lock operation for a test-and-set spinlock. */
+/* Counter of the psem library, with a shard per thread that threads add to
+ * without synchronizing with each other. Threads do not use the counter of
+ * the layout. Compare its throughput with Atomic add/sub in runs without -L,
+ * as timing each addition costs more than the addition itself. */
+
+pcounter_t pcounter;
+
+void
+sharded_init(int nthreads)
+{
+    pcounter_init_at(&pcounter, nthreads, 0);
 }
 
-void spin_unlock() {
-    /* TODO: Implement the unlock operation for a test-and-set spinlock. */
+int
+sharded_fini(void)
+{
+    int value = pcounter_read(&pcounter);
+
+    pcounter_fini(&pcounter);
+    return value;
 }
 
-/* Increments of the shared counter should be protected by a test-and-set spinlock */
 void *
-inc_tas_spinlock(void *arg __attribute__((unused)))
+inc_sharded(void *arg)
 {
+    lock_ctx_t *ctx = (lock_ctx_t *)arg;
     int i;
 
-    for (i = 0; i < INC_ITERATIONS; i++) {
-        /* TODO: Add the spin_lock() and spin_unlock() operations inside the loop. */
-        counter += INCREMENT;
+    for (i = 0; i < inc_iterations; i++) {
+        uint64_t start = latency_start();
+        pcounter_add(&pcounter, INCREMENT);
+        latency_stop(ctx->latency, start);
+        work(cs_work);
+        work(think_work);
     }
 
     return NULL;
 }
 
-/* Decrements of the shared counter should be protected by a test-and-set spinlock */
 void *
-dec_tas_spinlock(void *arg __attribute__((unused)))
+dec_sharded(void *arg)
 {
+    lock_ctx_t *ctx = (lock_ctx_t *)arg;
     int i;
 
-    for (i = 0; i < DEC_ITERATIONS; i++) {
-        /* TODO: Add the spin_lock() and spin_unlock() operations inside the loop. */
-        counter -= DECREMENT;
+    for (i = 0; i < dec_iterations; i++) {
+        uint64_t start = latency_start();
+        pcounter_add(&pcounter, -DECREMENT);
+        latency_stop(ctx->latency, start);
+        work(cs_work);
+        work(think_work);
     }
 
     return NULL;
 }
 
-
 /*******************************************************************************
-                      Tes 3 - Atomic addition/subtraction
+                                 Lock registry
 *******************************************************************************/
 
-/* Increment the shared counter using an atomic increment instruction */
+/* Spin loops pause the processor and yield it once every SPIN_LIMIT spins,
+ * so that a preempted lock holder gets to run when there are more threads
+ * than processors, while the waits in between stay pauses. */
+#define SPIN_LIMIT 100
+
+static inline void
+cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static inline void
+relax(int *spins)
+{
+    cpu_relax();
+    if (++*spins % SPIN_LIMIT == 0) {
+        sched_yield();
+    }
+}
+
+/* Pthread mutex lock */
+
+struct {
+    _Alignas(CACHE_LINE) pthread_mutex_t lock;
+    volatile int counter;
+} mutex = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+void
+mutex_lock(lock_ctx_t *ctx __attribute__((unused)))
+{
+    if (pthread_mutex_lock(&mutex.lock) != 0) {
+        perror("pthread_mutex_lock");
+        abort();
+    }
+}
+
+void
+mutex_unlock(lock_ctx_t *ctx __attribute__((unused)))
+{
+    if (pthread_mutex_unlock(&mutex.lock) != 0) {
+        perror("pthread_mutex_unlock");
+        abort();
+    }
+}
+
+/* Spinlock with test-and-set, every attempt writing the lock's cache line */
+
+struct {
+    _Alignas(CACHE_LINE) atomic_flag lock;
+    volatile int counter;
+} tas = { .lock = ATOMIC_FLAG_INIT };
+
+void
+tas_lock(lock_ctx_t *ctx __attribute__((unused)))
+{
+    int spins = 0;
+
+    while (atomic_flag_test_and_set_explicit(&tas.lock, memory_order_acquire)) {
+        relax(&spins);
+    }
+}
+
+void
+tas_unlock(lock_ctx_t *ctx __attribute__((unused)))
+{
+    atomic_flag_clear_explicit(&tas.lock, memory_order_release);
+}
+
+/* Test-and-test-and-set spinlock, waiting with reads only and backing off
+ * exponentially after a failed attempt */
+
+#define BACKOFF_MIN 4
+#define BACKOFF_MAX 1024
+
+struct {
+    _Alignas(CACHE_LINE) atomic_bool lock;
+    volatile int counter;
+} ttas;
+
+void
+ttas_lock(lock_ctx_t *ctx __attribute__((unused)))
+{
+    int backoff = BACKOFF_MIN;
+    int spins = 0;
+
+    for (;;) {
+        while (atomic_load_explicit(&ttas.lock, memory_order_relaxed)) {
+            relax(&spins);
+        }
+        if (!atomic_exchange_explicit(&ttas.lock, true, memory_order_acquire)) {
+            return;
+        }
+        // Back off with pauses only, without yielding.
+        for (int i = 0; i < backoff; i++) {
+            cpu_relax();
+        }
+        if (backoff < BACKOFF_MAX) {
+            backoff *= 2;
+        }
+    }
+}
+
+void
+ttas_unlock(lock_ctx_t *ctx __attribute__((unused)))
+{
+    atomic_store_explicit(&ttas.lock, false, memory_order_release);
+}
+
+/* FIFO ticket lock from the psem library */
+
+pticket_t ticket = PTICKET_INITIALIZER;
+
+void
+ticket_lock(lock_ctx_t *ctx __attribute__((unused)))
+{
+    pticket_lock(&ticket);
+}
+
+void
+ticket_unlock(lock_ctx_t *ctx __attribute__((unused)))
+{
+    pticket_unlock(&ticket);
+}
+
+/* MCS queue lock. Each waiter spins on the locked flag of its own node, which
+ * its predecessor clears when handing the lock over. */
+
+struct {
+    _Alignas(CACHE_LINE) _Atomic(qnode_t *) tail;
+    volatile int counter;
+} mcs;
+
+void
+mcs_lock(lock_ctx_t *ctx)
+{
+    qnode_t *node = &ctx->mcs;
+    int spins = 0;
+
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    atomic_store_explicit(&node->locked, true, memory_order_relaxed);
+
+    qnode_t *pred = atomic_exchange_explicit(&mcs.tail, node, memory_order_acq_rel);
+
+    if (pred != NULL) {
+        atomic_store_explicit(&pred->next, node, memory_order_release);
+
+        while (atomic_load_explicit(&node->locked, memory_order_acquire)) {
+            relax(&spins);
+        }
+    }
+}
+
+void
+mcs_unlock(lock_ctx_t *ctx)
+{
+    qnode_t *node = &ctx->mcs;
+    qnode_t *next = atomic_load_explicit(&node->next, memory_order_acquire);
+    int spins = 0;
+
+    if (next == NULL) {
+        qnode_t *expected = node;
+
+        // No one queued behind this thread.
+        if (atomic_compare_exchange_strong_explicit(&mcs.tail, &expected, NULL,
+                                                    memory_order_release,
+                                                    memory_order_relaxed)) {
+            return;
+        }
+        // A successor is linking itself in.
+        while ((next = atomic_load_explicit(&node->next, memory_order_acquire)) == NULL) {
+            relax(&spins);
+        }
+    }
+
+    atomic_store_explicit(&next->locked, false, memory_order_release);
+}
+
+/* CLH queue lock. Each waiter spins on the node of its predecessor and takes
+ * that node over for its next acquisition, so the nodes move between threads.
+ * The queue starts with a free dummy node. */
+
+struct {
+    _Alignas(CACHE_LINE) _Atomic(qnode_t *) tail;
+    volatile int counter;
+} clh;
+qnode_t *clh_nodes;  // The dummy node and one node per thread.
+int clh_num_nodes;
+
+void
+clh_init(lock_ctx_t *ctxs, int nthreads)
+{
+    clh_num_nodes = nthreads + 1;
+    clh_nodes = aligned_alloc(_Alignof(qnode_t), clh_num_nodes * sizeof(qnode_t));
+
+    if (clh_nodes == NULL) {
+        perror("aligned_alloc");
+        abort();
+    }
+
+    for (int i = 0; i < clh_num_nodes; i++) {
+        atomic_init(&clh_nodes[i].locked, false);
+    }
+    for (int i = 0; i < nthreads; i++) {
+        ctxs[i].clh = &clh_nodes[i + 1];
+    }
+    atomic_store(&clh.tail, &clh_nodes[0]);
+}
+
+void
+clh_lock(lock_ctx_t *ctx)
+{
+    qnode_t *node = ctx->clh;
+    int spins = 0;
+
+    atomic_store_explicit(&node->locked, true, memory_order_relaxed);
+
+    qnode_t *pred = atomic_exchange_explicit(&clh.tail, node, memory_order_acq_rel);
+
+    while (atomic_load_explicit(&pred->locked, memory_order_acquire)) {
+        relax(&spins);
+    }
+    ctx->clh_pred = pred;
+}
+
+void
+clh_unlock(lock_ctx_t *ctx)
+{
+    atomic_store_explicit(&ctx->clh->locked, false, memory_order_release);
+    ctx->clh = ctx->clh_pred;
+}
+
+void
+clh_fini(void)
+{
+    free(clh_nodes);
+    clh_nodes = NULL;
+}
+
+/* Binary semaphore from the psem library used as a mutex */
+
+struct {
+    _Alignas(CACHE_LINE) psem_t lock;
+    volatile int counter;
+} sem_mutex;
+
+void
+sem_init_mutex(lock_ctx_t *ctxs __attribute__((unused)), int nthreads __attribute__((unused)))
+{
+    psem_init_at(&sem_mutex.lock, 1);
+}
+
+void
+sem_lock(lock_ctx_t *ctx __attribute__((unused)))
+{
+    psem_wait(&sem_mutex.lock);
+}
+
+void
+sem_unlock(lock_ctx_t *ctx __attribute__((unused)))
+{
+    psem_signal(&sem_mutex.lock);
+}
+
+void
+sem_fini_mutex(void)
+{
+    psem_fini(&sem_mutex.lock);
+}
+
+lock_ops_t locks[] = {
+    { .name = "Pthread mutex",  .lock = mutex_lock,  .unlock = mutex_unlock,
+      .colocated = &mutex.counter },
+    { .name = "TAS spinlock",   .lock = tas_lock,    .unlock = tas_unlock,
+      .colocated = &tas.counter },
+    { .name = "TTAS backoff",   .lock = ttas_lock,   .unlock = ttas_unlock,
+      .colocated = &ttas.counter },
+    // The two counters of pticket_t have their cache lines to themselves.
+    { .name = "Ticket lock",    .lock = ticket_lock, .unlock = ticket_unlock },
+    { .name = "MCS lock",       .lock = mcs_lock,    .unlock = mcs_unlock,
+      .colocated = &mcs.counter },
+    { .name = "CLH lock",       .lock = clh_lock,    .unlock = clh_unlock,
+      .init = clh_init,         .fini = clh_fini,    .colocated = &clh.counter },
+    { .name = "psem mutex",     .lock = sem_lock,    .unlock = sem_unlock,
+      .init = sem_init_mutex,   .fini = sem_fini_mutex, .colocated = &sem_mutex.counter },
+    { .name = NULL }
+};
+
+/* Increments of the shared counter protected by the lock of the thread's
+ * context */
 void *
-inc_atomic(void *arg __attribute__((unused)))
+inc_locked(void *arg)
 {
+    lock_ctx_t *ctx = (lock_ctx_t *)arg;
     int i;
 
-    for (i = 0; i < INC_ITERATIONS; i++) {
-        /* TODO: Use atomic addition to increment the shared counter */
-
-        counter += INCREMENT; // You need to replace this.
+    for (i = 0; i < inc_iterations; i++) {
+        uint64_t start = latency_start();
+        ctx->ops->lock(ctx);
+        latency_stop(ctx->latency, start);
+        *ctx->counter += INCREMENT;
+        work(cs_work);
+        ctx->ops->unlock(ctx);
+        work(think_work);
     }
 
     return NULL;
 }
 
-/* Decrement the shared counter using an atomic increment instruction */
+/* Decrements of the shared counter protected by the lock of the thread's
+ * context */
 void *
-dec_atomic(void *arg __attribute__((unused)))
+dec_locked(void *arg)
 {
+    lock_ctx_t *ctx = (lock_ctx_t *)arg;
     int i;
 
-    for (i = 0; i < DEC_ITERATIONS; i++) {
-        /* TODO: Use atomic subtraction to increment the shared counter */
-
-        counter -= DECREMENT; // You need to replace this.
+    for (i = 0; i < dec_iterations; i++) {
+        uint64_t start = latency_start();
+        ctx->ops->lock(ctx);
+        latency_stop(ctx->latency, start);
+        *ctx->counter -= DECREMENT;
+        work(cs_work);
+        ctx->ops->unlock(ctx);
+        work(think_work);
     }
 
     return NULL;
 }
 
-/*******************************************************************************
- *******************************************************************************
-            NOTE: You don't need to modify anything below this line
- *******************************************************************************
- ******************************************************************************/
+/* Percentiles of the latency reported for each test case with -L, followed by
+ * the largest latency. */
+const double percentiles[] = { 50, 90, 99, 99.9 };
+const char *percentile_names[] = { "p50", "p90", "p99", "p99.9", "max" };
+
+#define NUM_PERCENTILES (sizeof(percentiles) / sizeof(percentiles[0]))
 
 /* Each test case is represented by the following struct. */
 
@@ -191,19 +636,79 @@ typedef struct {
     char *name;            // Test case name.
     void * (*inc)(void *); // Increment function.
     void * (*dec)(void *); // Decrement function.
+    lock_ops_t *ops;       // Lock used by inc_locked() and dec_locked(), if any.
+    void (*init)(int nthreads);  // Optional, sets up a counter of the test case's own.
+    int (*fini)(void);           // Optional, returns the final value of that counter.
     double total_time;     // Total runtime;
     double average_time;   // Average execution time per thread.
+    double wall_time;      // Time from creating the first thread to joining the last.
     int counter;           // Final value of the shared counter.
+    int expected;          // Final value of the shared counter if no update is lost.
+    uint64_t latency[NUM_PERCENTILES + 1];  // Latency percentiles and maximum (ns), with -L.
+    enum layout layout;    // Layout of the counter the test case ran with.
 } test_t;
 
-test_t tests[] = {
+#define NUM_LOCKS (sizeof(locks) / sizeof(locks[0]) - 1)
+
+/* The test cases without a lock, followed by one for each lock in locks[]. */
+test_t tests[3 + NUM_LOCKS + 1] = {
     { .inc = inc_no_sync,      .dec = dec_no_sync,      .name = "No synchronization"},
-    { .inc = inc_mutex,        .dec = dec_mutex,        .name = "Pthread mutex"},
-    { .inc = inc_tas_spinlock, .dec = dec_tas_spinlock, .name = "Spinlock"},
     { .inc = inc_atomic,       .dec = dec_atomic,       .name = "Atomic add/sub"},
-    { .inc = NULL,             .dec = NULL,             .name = NULL}
+    { .inc = inc_sharded,      .dec = dec_sharded,      .name = "Sharded counter",
+      .init = sharded_init,    .fini = sharded_fini },
 };
 
+void init_tests() {
+    test_t *test = &tests[3];
+
+    for (lock_ops_t *ops = locks; ops->name; ops++, test++) {
+        *test = (test_t) { .inc = inc_locked, .dec = dec_locked, .ops = ops, .name = ops->name };
+    }
+    *test = (test_t) { .inc = NULL, .dec = NULL, .name = NULL };
+}
+
+/* How the results are printed: the statistics of every thread and a summary
+ * as text, or one row or object per test case as CSV or JSON. */
+enum format {text, csv, json} format = text;
+
+/* CPUs of the threads, see placement.h. */
+placement_t placement;
+
+/* Largest number of threads when sweeping from one thread up, 0 for a single
+ * run with inc_threads and dec_threads. */
+int sweep = 0;
+
+/* Gives the decrementing threads the iterations it takes to bring the counter
+ * back to zero, or as many as the incrementing threads if they cannot. */
+void
+balance(void)
+{
+    long up = (long)inc_threads * inc_iterations * INCREMENT;
+
+    if (dec_threads > 0 && up % ((long)dec_threads * DECREMENT) == 0) {
+        dec_iterations = up / dec_threads / DECREMENT;
+    } else {
+        dec_iterations = inc_iterations;
+    }
+}
+
+/* Whether the counter, an int, holds the sum of all increments and of all
+ * decrements with the current parameters. */
+bool
+counter_fits(void)
+{
+    balance();
+
+    return (long long)inc_threads * inc_iterations * INCREMENT <= INT_MAX &&
+           (long long)dec_threads * dec_iterations * DECREMENT <= INT_MAX;
+}
+
+/* Increments and decrements done by all threads of a test case. */
+long
+operations(void)
+{
+    return (long)inc_threads * inc_iterations + (long)dec_threads * dec_iterations;
+}
 
 // Information about each thread will be kept in the following struct.
 
@@ -218,6 +723,8 @@ typedef struct {
     void *(*start_routine)(void *);
     // ... with arg as its sole argument.
     void *arg;
+    // Iterations done by the thread.
+    int iterations;
     // Total runtime of the thread.
     double run_time;
 } thread_t;
@@ -249,93 +756,238 @@ generic_thread(void *_conf)
 
 
 double
-print_stats(thread_t *threads, int nthreads, int niterations, test_t *test)
+print_stats(thread_t *threads, int nthreads, test_t *test, bool verbose)
 {
     double run_time_sum = 0;
     double average_execution_time = 0;
 
-    printf("\nStatistics:\n\n");
+    if (verbose) {
+        printf("\nStatistics:\n\n");
+    }
     for (int i = 0; i < nthreads; i++) {
         thread_t *t = &threads[i];
-        printf("Thread %i (%s): %.4f sec (%.4e iterations/s)\n",
-               i, type2string(t->type), t->run_time,
-               niterations / nthreads / t->run_time);
+        if (verbose) {
+            printf("Thread %i (%s): %.4f sec (%.4e iterations/s)\n",
+                   i, type2string(t->type), t->run_time,
+                   t->iterations / t->run_time);
+        }
         run_time_sum += t->run_time;
     }
 
     average_execution_time = run_time_sum /nthreads;
 
-    printf("\nAverage execution time: %.4f s/thread\n"
-           "\nAvergage iterations/second: %.4e iterations/s\n",
-           average_execution_time,
-           niterations / nthreads / run_time_sum);
+    if (verbose) {
+        printf("\nAverage execution time: %.4f s/thread\n"
+               "\nAvergage iterations/second: %.4e iterations/s\n",
+               average_execution_time,
+               operations() / run_time_sum);
+    }
 
     test->total_time = run_time_sum;
     return average_execution_time;
 }
 
-char *successOrFailure(int counter) {
-    return (counter == 0) ? "success" : "failure";
+char *successOrFailure(test_t *test) {
+    return (test->counter == test->expected) ? "success" : "failure";
+}
+
+/* Operations per second of all threads together. */
+double
+throughput(test_t *test)
+{
+    return operations() / test->wall_time;
+}
+
+/* Mean time in nanoseconds a thread takes per operation. */
+double
+latency(test_t *test)
+{
+    return 1e9 * test->total_time / operations();
 }
+
 void print_stats_summary(test_t tests[]) {
     test_t *test = tests;
     int width = 20;
 
     printf("\n\n=========================================================================================\n\n");
-    printf("                                       SUMMARY\n\n\n");
-
-    printf("%*s                             Total run      Average execution time\n", width, "");
-    printf("%*s     Counter     Result      time (sec)     per thread (sec/thread)\n", width, "Test Case");
-    printf("-----------------------------------------------------------------------------------------\n");
+    printf("                                       SUMMARY\n\n");
+    printf("%d incrementing and %d decrementing threads, %d and %d iterations each\n",
+           inc_threads, dec_threads, inc_iterations, dec_iterations);
+    printf("Counter layout: %s%s\n", layout_names[layout],
+           (layout == colocated) ? ", padded without a lock word to share" : "");
+    placement_print(&placement, inc_threads + dec_threads);
+    printf("\n\n");
+
+    printf("%*s                             Total run      Average execution time     Throughput\n", width, "");
+    printf("%*s     Counter     Result      time (sec)     per thread (sec/thread)    (ops/sec)\n", width, "Test Case");
+    printf("--------------------------------------------------------------------------------------------------------\n");
 
     while (test->inc && test->dec) {
-        printf("%*s     %-10d  %s     %f       %f\n",
+        printf("%*s     %-10d  %s     %f       %f                   %.4e\n",
                width,
                test->name,
                test->counter,
-               successOrFailure(test->counter),
+               successOrFailure(test),
                test->total_time,
-               test->average_time);
+               test->average_time,
+               throughput(test));
         test++;
     }
+
+    if (!record_latency) {
+        return;
+    }
+
+    printf("\n\nLatency of each lock acquisition, or of each update without a lock (ns)\n\n");
+    printf("%*s", width, "Test Case");
+    for (size_t p = 0; p <= NUM_PERCENTILES; p++) {
+        printf("  %10s", percentile_names[p]);
+    }
+    printf("\n--------------------------------------------------------------------------------------------------------\n");
+
+    for (test = tests; test->inc && test->dec; test++) {
+        printf("%*s", width, test->name);
+        for (size_t p = 0; p <= NUM_PERCENTILES; p++) {
+            printf("  %10llu", (unsigned long long)test->latency[p]);
+        }
+        printf("\n");
+    }
+}
+
+void print_csv_header(void) {
+    printf("test,layout,placement,threads,inc_threads,dec_threads,inc_iterations,dec_iterations,"
+           "cs_work,think_work,counter,expected,result,wall_time_s,throughput_ops_s,"
+           "latency_ns");
+    for (size_t p = 0; record_latency && p <= NUM_PERCENTILES; p++) {
+        printf(",%s_ns", percentile_names[p]);
+    }
+    printf("\n");
+}
+
+void print_csv(test_t tests[]) {
+    for (test_t *test = tests; test->inc && test->dec; test++) {
+        printf("%s,%s,\"%s\",%d,%d,%d,%d,%d,%d,%d,%d,%d,%s,%.6f,%.4e,%.1f",
+               test->name, layout_names[test->layout], placement.name, inc_threads + dec_threads, inc_threads, dec_threads,
+               inc_iterations, dec_iterations, cs_work, think_work,
+               test->counter, test->expected, successOrFailure(test),
+               test->wall_time, throughput(test), latency(test));
+        for (size_t p = 0; record_latency && p <= NUM_PERCENTILES; p++) {
+            printf(",%llu", (unsigned long long)test->latency[p]);
+        }
+        printf("\n");
+    }
+}
+
+/* Prints the test cases as objects of a JSON array, the first of which opens
+ * the array. The caller closes it. */
+void print_json(test_t tests[], bool *first) {
+    for (test_t *test = tests; test->inc && test->dec; test++) {
+        printf("%s\n  {\"test\": \"%s\", \"layout\": \"%s\", \"placement\": \"%s\", \"threads\": %d, \"inc_threads\": %d, \"dec_threads\": %d, "
+               "\"inc_iterations\": %d, \"dec_iterations\": %d, \"cs_work\": %d, \"think_work\": %d, "
+               "\"counter\": %d, \"expected\": %d, \"result\": \"%s\", \"wall_time_s\": %.6f, "
+               "\"throughput_ops_s\": %.4e, \"latency_ns\": %.1f",
+               *first ? "[" : ",",
+               test->name, layout_names[test->layout], placement.name, inc_threads + dec_threads, inc_threads, dec_threads,
+               inc_iterations, dec_iterations, cs_work, think_work,
+               test->counter, test->expected, successOrFailure(test),
+               test->wall_time, throughput(test), latency(test));
+        for (size_t p = 0; record_latency && p <= NUM_PERCENTILES; p++) {
+            printf(", \"%s_ns\": %llu", percentile_names[p], (unsigned long long)test->latency[p]);
+        }
+        printf("}");
+        *first = false;
+    }
+}
+
+/* Creates thread number i of n on its CPU. */
+void
+create_thread(thread_t *thread, int i, int n)
+{
+    pthread_attr_t attr;
+
+    if (pthread_attr_init(&attr) != 0) {
+        perror("pthread_attr_init");
+        abort();
+    }
+
+    placement_attr(&placement, &attr, i, n);
+
+    if (pthread_create(&thread->tid, &attr, generic_thread, thread) != 0) {
+        perror("pthread_create");
+        abort();
+    }
+    pthread_attr_destroy(&attr);
 }
 
 void run_test(test_t *test) {
     int i, nthreads = 0;
-    thread_t threads[INC_THREADS + DEC_THREADS];
+    thread_t threads[inc_threads + dec_threads];
+    lock_ctx_t ctxs[inc_threads + dec_threads];
     double average_execution_time = 0;
+    bool verbose = (format == text && sweep == 0);
+    struct timespec ts;
+
+    pthread_setconcurrency(inc_threads + dec_threads);
+
+    /* Lay out the counter */
+
+    volatile int *shared = &counter.value;
+
+    test->layout = layout;
+
+    if (layout == colocated && test->ops && test->ops->colocated) {
+        shared = test->ops->colocated;
+    } else if (layout == colocated) {
+        test->layout = padded;
+    }
+
+    if (test->init) {
+        test->layout = sharded;  // Whatever the layout, the counter of its own is.
+    }
+
+    *shared = 0;
+
+    for (i = 0; i < inc_threads + dec_threads; i++) {
+        ctxs[i] = (lock_ctx_t) { .ops = test->ops };
+        ctxs[i].latency = record_latency ? histogram_init() : NULL;
+        ctxs[i].counter = (layout == sharded) ? &ctxs[i].shard : shared;
+    }
 
-    pthread_setconcurrency(INC_THREADS + DEC_THREADS);
+    if (test->ops && test->ops->init) {
+        test->ops->init(ctxs, inc_threads + dec_threads);
+    }
 
-    counter = 0;
+    if (test->init) {
+        test->init(inc_threads + dec_threads);
+    }
 
-    pthread_setconcurrency(INC_THREADS + DEC_THREADS + 1);
+    pthread_setconcurrency(inc_threads + dec_threads + 1);
+
+    timing_start(&ts);
 
     /* Create the incrementing threads */
 
-    for (i = 0; i < INC_THREADS; i++) {
+    for (i = 0; i < inc_threads; i++) {
         thread_t *thread = &threads[nthreads];
         thread->id = nthreads;
         thread->type = inc;
         thread->start_routine = test->inc;
-        if (pthread_create(&thread->tid, NULL, generic_thread, thread) != 0) {
-            perror("pthread_create");
-            abort();
-        }
+        thread->arg = &ctxs[nthreads];
+        thread->iterations = inc_iterations;
+        create_thread(thread, nthreads, inc_threads + dec_threads);
         nthreads++;
     }
 
     /* Create the decrementing threads */
 
-    for (i = 0; i < DEC_THREADS; i++) {
+    for (i = 0; i < dec_threads; i++) {
         thread_t *thread = &threads[nthreads];
         thread->id = nthreads;
         thread->type = dec;
         thread->start_routine = test->dec;
-        if (pthread_create(&thread->tid, NULL, generic_thread, thread) != 0) {
-            perror("pthread_create");
-            abort();
-        }
+        thread->arg = &ctxs[nthreads];
+        thread->iterations = dec_iterations;
+        create_thread(thread, nthreads, inc_threads + dec_threads);
         nthreads++;
     }
 
@@ -346,35 +998,248 @@ void run_test(test_t *test) {
             perror("pthread_join");
             abort();
         }
-    printf("\n==========================================================================\n");
-    printf("%s\n\n", test->name);
-    printf("Counter expected value:%10d\n", 0);
-    printf("Counter actual value:  %10d\n", counter);
 
-    test -> counter = counter;
+    test->wall_time = timing_stop(&ts);
 
-    if (counter != 0) {
-        printf("\nFAILURE :-(\n");
-    } else {
-        printf("\nSUCCES :-)\n");
+    if (test->ops && test->ops->fini) {
+        test->ops->fini();
     }
 
-    average_execution_time = print_stats(threads, nthreads, INC_ITERATIONS + DEC_ITERATIONS, test);
+    /* Merge the latencies of all threads */
+
+    if (record_latency) {
+        histogram_t *latency = histogram_init();
+
+        for (i = 0; i < nthreads; i++) {
+            histogram_merge(latency, ctxs[i].latency);
+            histogram_destroy(ctxs[i].latency);
+        }
+        for (size_t p = 0; p < NUM_PERCENTILES; p++) {
+            test->latency[p] = histogram_percentile(latency, percentiles[p]);
+        }
+        test->latency[NUM_PERCENTILES] = latency->max;
+        histogram_destroy(latency);
+    }
+
+    test -> counter = *shared;
+
+    if (test->fini) {
+        test->counter = test->fini();
+    } else if (layout == sharded) {
+        for (i = 0; i < nthreads; i++) {
+            test->counter += ctxs[i].shard;
+        }
+    }
+    test -> expected = inc_threads * inc_iterations * INCREMENT - dec_threads * dec_iterations * DECREMENT;
+
+    if (verbose) {
+        printf("\n==========================================================================\n");
+        printf("%s\n\n", test->name);
+        printf("Counter expected value:%10d\n", test->expected);
+        printf("Counter actual value:  %10d\n", test->counter);
+
+        if (test->counter != test->expected) {
+            printf("\nFAILURE :-(\n");
+        } else {
+            printf("\nSUCCES :-)\n");
+        }
+    }
+
+    average_execution_time = print_stats(threads, nthreads, test, verbose);
     test -> average_time = average_execution_time;
 
 }
 
-int
-main()
+/* Runs all test cases with the current parameters and prints the results. */
+void
+run_tests(bool *first)
 {
     test_t *test = tests;
 
+    balance();
+
     while (test->inc && test->dec) {
         run_test(test);
         test++;
     }
 
-    print_stats_summary(tests);
+    switch (format) {
+    case text: print_stats_summary(tests); break;
+    case csv:  print_csv(tests); break;
+    case json: print_json(tests, first); break;
+    }
+}
+
+/* Sets *value from the environment variable name, if there is one. */
+void
+getenv_int(const char *name, int *value)
+{
+    char *s = getenv(name);
+
+    if (s != NULL) {
+        *value = atoi(s);
+    }
+}
+
+/* Sets the layouts to run with, one of layout_names or all. */
+bool
+parse_layout(const char *s, enum layout *first, enum layout *last)
+{
+    if (strcmp(s, "all") == 0) {
+        *first = colocated;
+        *last = sharded;
+        return true;
+    }
+    for (enum layout l = colocated; l <= sharded; l++) {
+        if (strcmp(s, layout_names[l]) == 0) {
+            *first = *last = l;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool
+parse_format(const char *s)
+{
+    if (strcmp(s, "text") == 0) {
+        format = text;
+    } else if (strcmp(s, "csv") == 0) {
+        format = csv;
+    } else if (strcmp(s, "json") == 0) {
+        format = json;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void
+usage(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [-i threads] [-d threads] [-n iterations] [-c work] [-w work]\n"
+                    "       [-s max_threads] [-f text|csv|json] [-p placement] [-l layout] [-L]\n\n", argv[0]);
+    fprintf(stderr, "  -i  Incrementing threads (default %d, MUTEX_INC_THREADS).\n", INC_THREADS);
+    fprintf(stderr, "  -d  Decrementing threads (default %d, MUTEX_DEC_THREADS).\n", DEC_THREADS);
+    fprintf(stderr, "  -n  Iterations per incrementing thread (default %d, MUTEX_ITERATIONS).\n"
+                    "      Decrementing threads do as many as it takes to get back to zero.\n",
+            INC_ITERATIONS);
+    fprintf(stderr, "  -c  Units of work inside each critical section (default 0, MUTEX_CS_WORK).\n");
+    fprintf(stderr, "  -w  Units of work between critical sections (default 0, MUTEX_THINK_WORK).\n");
+    fprintf(stderr, "  -s  Run with 1 up to max_threads threads, half of them decrementing\n"
+                    "      (MUTEX_SWEEP).\n");
+    fprintf(stderr, "  -f  Output format (default text, MUTEX_FORMAT).\n");
+    fprintf(stderr, "  -p  Thread placement, none, compact, smt, scatter, cross-socket or a list\n"
+                    "      of CPUs such as 0,2,4-7, incrementing threads first (default none,\n"
+                    "      MUTEX_PLACEMENT).\n");
+    fprintf(stderr, "  -l  Counter layout, colocated with the lock word, padded to a cache line\n"
+                    "      of its own, sharded over the threads or all of them (default padded,\n"
+                    "      MUTEX_LAYOUT).\n");
+    fprintf(stderr, "  -L  Time every lock acquisition, or every update without a lock, and\n"
+                    "      report latency percentiles (MUTEX_LATENCY=1). The timing slows the\n"
+                    "      threads down, so compare throughput between runs without -L.\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    bool first = true;
+    char *placement_name = "none";
+    enum layout first_layout = padded, last_layout = padded;
+    char *s;
+    int opt;
+
+    /* Parameters from the environment, overridden by the command line */
+
+    getenv_int("MUTEX_INC_THREADS", &inc_threads);
+    getenv_int("MUTEX_DEC_THREADS", &dec_threads);
+    getenv_int("MUTEX_ITERATIONS", &inc_iterations);
+    getenv_int("MUTEX_CS_WORK", &cs_work);
+    getenv_int("MUTEX_THINK_WORK", &think_work);
+    getenv_int("MUTEX_SWEEP", &sweep);
+
+    int latency_env = 0;
+
+    getenv_int("MUTEX_LATENCY", &latency_env);
+    record_latency = latency_env != 0;
+
+    if ((s = getenv("MUTEX_PLACEMENT")) != NULL) {
+        placement_name = s;
+    }
+
+    if ((s = getenv("MUTEX_LAYOUT")) != NULL && !parse_layout(s, &first_layout, &last_layout)) {
+        usage(argv);
+    }
+
+    if ((s = getenv("MUTEX_FORMAT")) != NULL && !parse_format(s)) {
+        usage(argv);
+    }
+
+    while ((opt = getopt(argc, argv, "i:d:n:c:w:s:f:p:l:L")) != -1) {
+        switch (opt) {
+        case 'i': inc_threads = atoi(optarg); break;
+        case 'd': dec_threads = atoi(optarg); break;
+        case 'n': inc_iterations = atoi(optarg); break;
+        case 'c': cs_work = atoi(optarg); break;
+        case 'w': think_work = atoi(optarg); break;
+        case 's': sweep = atoi(optarg); break;
+        case 'f': if (!parse_format(optarg)) usage(argv); break;
+        case 'p': placement_name = optarg; break;
+        case 'l': if (!parse_layout(optarg, &first_layout, &last_layout)) usage(argv); break;
+        case 'L': record_latency = true; break;
+        default:  usage(argv);
+        }
+    }
+
+    if (inc_threads < 1 || dec_threads < 0 || inc_iterations < 1 ||
+        cs_work < 0 || think_work < 0 || sweep < 0 || optind < argc) {
+        usage(argv);
+    }
+
+    if (!placement_init(&placement, placement_name)) {
+        usage(argv);
+    }
+
+    init_tests();
+
+    if (format == csv) {
+        print_csv_header();
+    }
+
+    int max_inc_threads = inc_threads, max_dec_threads = dec_threads;
+
+    // The sweep ends with the most threads.
+    if (sweep > 0) {
+        inc_threads = (sweep + 1) / 2;
+        dec_threads = sweep / 2;
+    }
+    if (!counter_fits()) {
+        fprintf(stderr, "%d incrementing and %d decrementing threads, %d iterations each,\n"
+                        "would take the counter beyond %d\n",
+                inc_threads, dec_threads, inc_iterations, INT_MAX);
+        exit(EXIT_FAILURE);
+    }
+
+    for (layout = first_layout; layout <= last_layout; layout++) {
+        if (sweep == 0) {
+            inc_threads = max_inc_threads;
+            dec_threads = max_dec_threads;
+            run_tests(&first);
+        } else {
+            for (int n = 1; n <= sweep; n++) {
+                inc_threads = (n + 1) / 2;
+                dec_threads = n / 2;
+                run_tests(&first);
+            }
+        }
+    }
+
+    if (format == json) {
+        printf("\n]\n");
+    }
+
+    placement_destroy(&placement);
 
     exit(EXIT_SUCCESS);
 }
@@ -0,0 +1,162 @@
+/**
+ * Unit test of the sharded counter.
+ *
+ * Its speed is compared with a single atomic counter by the Sharded counter
+ * test case of mutex, run without -L so that additions are not timed.
+ */
+
+#include <stdio.h>   // printf()
+#include <stdlib.h>  // exit()
+#include <unistd.h>  // usleep()
+#include <pthread.h> // pthread_...
+#include <assert.h>  // assert()
+
+#include "psem.h"
+#include "pcounter.h"
+
+#define TEST_HEADER printf("\n==== %s ====\n\n", __FUNCTION__)
+
+#define THREADS    8
+#define ITERATIONS 20000
+
+void success() {
+  printf("\nTest SUCCESSFUL :-)\n\n");
+}
+
+/* Threads with an even index add one, those with an odd index add two and
+   take away one. */
+void *adder(void *arg) {
+  pcounter_t *counter = (pcounter_t *) arg;
+
+  for (int i = 0; i < ITERATIONS; i++) {
+    pcounter_add(counter, 1);
+  }
+  pthread_exit(NULL);
+}
+
+void *mixer(void *arg) {
+  pcounter_t *counter = (pcounter_t *) arg;
+
+  for (int i = 0; i < ITERATIONS; i++) {
+    pcounter_add(counter, 2);
+    pcounter_add(counter, -1);
+  }
+  pthread_exit(NULL);
+}
+
+/* Every addition is counted, with fewer, as many and more shards than
+   threads. */
+void sum_test(int flags) {
+  TEST_HEADER;
+
+  unsigned int shards[] = { 1, THREADS / 2, THREADS, 2*THREADS, 0 };
+
+  for (int s = 0; s < (int) (sizeof(shards) / sizeof(shards[0])); s++) {
+    pcounter_t *counter = pcounter_init(shards[s], flags);
+    pthread_t tid[THREADS];
+
+    assert(pcounter_read(counter) == 0);
+
+    for (int i = 0; i < THREADS; i++) {
+      pthread_create(&tid[i], NULL, (i % 2) ? mixer : adder, counter);
+    }
+    for (int i = 0; i < THREADS; i++) {
+      pthread_join(tid[i], NULL);
+    }
+
+    printf("%2u shards%s: %ld\n", counter->num_shards,
+           (flags & PCOUNTER_PER_CPU) ? " per CPU" : "", pcounter_read(counter));
+
+    assert(pcounter_read(counter) == THREADS * ITERATIONS);
+
+    pcounter_destroy(counter);
+  }
+
+  success();
+}
+
+/* Updates spread over more than one shard when threads have shards of
+   their own. */
+void shard_test() {
+  TEST_HEADER;
+
+  pcounter_t counter;
+  pthread_t tid[THREADS];
+  int used = 0;
+
+  pcounter_init_at(&counter, THREADS, 0);
+
+  for (int i = 0; i < THREADS; i++) {
+    pthread_create(&tid[i], NULL, adder, &counter);
+  }
+  for (int i = 0; i < THREADS; i++) {
+    pthread_join(tid[i], NULL);
+  }
+
+  for (unsigned int i = 0; i < counter.num_shards; i++) {
+    used += atomic_load(&counter.shards[i].value) != 0;
+  }
+
+  printf("%d of %u shards used by %d threads\n", used, counter.num_shards, THREADS);
+  assert(used > 1);
+
+  pcounter_fini(&counter);
+
+  success();
+}
+
+/* An approximate read returns an old sum while it is recent enough. The bound
+   is an hour so that no scheduling delay can let the sum grow too old. */
+void approximate_test() {
+  TEST_HEADER;
+
+  pcounter_t counter;
+
+  pcounter_init_at(&counter, 0, 0);
+  pcounter_approximate(&counter, 3600000000000);  // 1 h
+
+  pcounter_add(&counter, 1);
+  assert(pcounter_read(&counter) == 1);
+
+  pcounter_add(&counter, 1);
+  assert(pcounter_read(&counter) == 1);
+
+  pcounter_approximate(&counter, 0);
+  assert(pcounter_read(&counter) == 2);
+
+  pcounter_fini(&counter);
+
+  success();
+}
+
+/* An approximate read sums the shards again once the old sum has grown too
+   old, here after 1 ns. */
+void refresh_test() {
+  TEST_HEADER;
+
+  pcounter_t counter;
+
+  pcounter_init_at(&counter, 0, 0);
+  pcounter_approximate(&counter, 1);  // 1 ns
+
+  pcounter_add(&counter, 1);
+  assert(pcounter_read(&counter) == 1);
+
+  pcounter_add(&counter, 1);
+  usleep(1000);
+  assert(pcounter_read(&counter) == 2);
+
+  pcounter_fini(&counter);
+
+  success();
+}
+
+int main() {
+  setbuf(stdout, NULL);
+
+  sum_test(0);
+  sum_test(PCOUNTER_PER_CPU);
+  shard_test();
+  approximate_test();
+  refresh_test();
+}
@@ -0,0 +1,315 @@
+#define _GNU_SOURCE // cpu_set_t, sched_getaffinity(), pthread_attr_setaffinity_np()
+
+#include "placement.h"
+
+#include <stdio.h>  // printf(), fprintf(), fopen(), fscanf()
+#include <stdlib.h> // malloc(), qsort(), exit()
+#include <string.h> // strcmp()
+#include <ctype.h>  // isdigit()
+#include <sched.h>  // cpu_set_t, sched_getaffinity()
+
+static const struct {
+  const char *name;
+  placement_kind_t kind;
+} kinds[] = {
+  { "none",         PLACEMENT_NONE },
+  { "compact",      PLACEMENT_COMPACT },
+  { "smt",          PLACEMENT_SMT },
+  { "scatter",      PLACEMENT_SCATTER },
+  { "cross-socket", PLACEMENT_CROSS_SOCKET },
+};
+
+#define NUM_KINDS (int) (sizeof(kinds) / sizeof(kinds[0]))
+
+static void *checked_malloc(size_t size) {
+  void *p = malloc(size);
+
+  if (p == NULL) {
+    perror("Could not allocate thread placement");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+#ifdef __linux__
+
+/*******************************************************************************
+                                   Topology
+********************************************************************************/
+
+typedef struct {
+  int cpu;
+  int package;  // Index among the packages, from 0.
+  int core;     // core_id, unique within a package only.
+  int smt;      // Index among the SMT siblings of the core, from 0.
+} cpu_info_t;
+
+/* The number in the topology file of cpu, or -1 if there is none. */
+static int topology(int cpu, const char *file) {
+  char path[128];
+  int value = -1;
+
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, file);
+
+  FILE *f = fopen(path, "r");
+
+  if (f != NULL) {
+    if (fscanf(f, "%d", &value) != 1) {
+      value = -1;
+    }
+    fclose(f);
+  }
+  return value;
+}
+
+static int by_package_core_cpu(const void *a, const void *b) {
+  const cpu_info_t *x = a, *y = b;
+
+  if (x->package != y->package) return x->package - y->package;
+  if (x->core != y->core) return x->core - y->core;
+  return x->cpu - y->cpu;
+}
+
+static int by_package_smt_core(const void *a, const void *b) {
+  const cpu_info_t *x = a, *y = b;
+
+  if (x->package != y->package) return x->package - y->package;
+  if (x->smt != y->smt) return x->smt - y->smt;
+  if (x->core != y->core) return x->core - y->core;
+  return x->cpu - y->cpu;
+}
+
+/* Lays out the CPUs the process may run on in the order of placement. A CPU
+   without topology files counts as a core of its own on package 0. */
+static void read_topology(placement_t *placement) {
+  cpu_set_t allowed;
+
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    perror("Could not get the CPUs of the process");
+    exit(EXIT_FAILURE);
+  }
+
+  int n = CPU_COUNT(&allowed);
+  cpu_info_t *info = checked_malloc(n * sizeof(cpu_info_t));
+  int *packages = checked_malloc(n * sizeof(int));
+  int num_packages = 0;
+
+  for (int cpu = 0, i = 0; i < n; cpu++) {
+    if (!CPU_ISSET(cpu, &allowed)) continue;
+
+    int package = topology(cpu, "physical_package_id");
+    int core = topology(cpu, "core_id");
+
+    info[i] = (cpu_info_t) {
+      .cpu = cpu,
+      .package = (package < 0) ? 0 : package,
+      .core = (core < 0) ? cpu : core,
+    };
+
+    // Give the packages indices in order of their ids.
+    int p = 0;
+
+    while (p < num_packages && packages[p] != info[i].package) p++;
+    if (p == num_packages) packages[num_packages++] = info[i].package;
+    i++;
+  }
+
+  for (int i = 0; i < n; i++) {
+    int index = 0;
+
+    for (int p = 0; p < num_packages; p++) {
+      if (packages[p] < info[i].package) index++;
+    }
+    info[i].package = index;
+  }
+
+  // Number the SMT siblings of each core in order of CPU.
+  qsort(info, n, sizeof(cpu_info_t), by_package_core_cpu);
+
+  for (int i = 0; i < n; i++) {
+    bool sibling = i > 0 && info[i].package == info[i - 1].package && info[i].core == info[i - 1].core;
+
+    info[i].smt = sibling ? info[i - 1].smt + 1 : 0;
+  }
+
+  if (placement->kind != PLACEMENT_SMT) {
+    qsort(info, n, sizeof(cpu_info_t), by_package_smt_core);
+  }
+
+  placement->num_cpus = n;
+  placement->cpus = checked_malloc(n * sizeof(int));
+  placement->num_packages = num_packages;
+  placement->package_start = checked_malloc((num_packages + 1) * sizeof(int));
+
+  for (int i = 0, p = 0; i < n; i++) {
+    placement->cpus[i] = info[i].cpu;
+
+    while (p <= info[i].package) {
+      placement->package_start[p++] = i;
+    }
+  }
+  placement->package_start[num_packages] = n;
+
+  free(packages);
+  free(info);
+}
+
+/* Parses a list of CPUs such as 0,2,4-7 into placement, checking that the
+   process may run on every CPU listed. */
+static bool read_list(placement_t *placement, const char *list) {
+  cpu_set_t allowed;
+  int first, last, length;
+
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    perror("Could not get the CPUs of the process");
+    exit(EXIT_FAILURE);
+  }
+
+  placement->num_cpus = 0;
+  placement->cpus = checked_malloc(CPU_SETSIZE * sizeof(int));
+
+  for (const char *s = list; ; s++) {
+    if (!isdigit((unsigned char) *s) || sscanf(s, "%d%n", &first, &length) != 1) {
+      break;
+    }
+    s += length;
+    last = first;
+
+    if (*s == '-') {
+      if (!isdigit((unsigned char) s[1]) || sscanf(s + 1, "%d%n", &last, &length) != 1) {
+        break;
+      }
+      s += length + 1;
+    }
+
+    for (int cpu = first; cpu <= last; cpu++) {
+      if (cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed) || placement->num_cpus == CPU_SETSIZE) {
+        fprintf(stderr, "Thread placement %s: the process may not run on CPU %d\n", list, cpu);
+        return false;
+      }
+      placement->cpus[placement->num_cpus++] = cpu;
+    }
+
+    if (*s == '\0') {
+      return placement->num_cpus > 0;
+    }
+    if (*s != ',') {
+      break;
+    }
+  }
+
+  fprintf(stderr, "Unknown thread placement %s\n", list);
+  return false;
+}
+
+#endif
+
+/*******************************************************************************
+                                  Placement
+********************************************************************************/
+
+bool placement_init(placement_t *placement, const char *name) {
+  *placement = (placement_t) { .kind = PLACEMENT_LIST, .name = name };
+
+  for (int k = 0; k < NUM_KINDS; k++) {
+    if (strcmp(name, kinds[k].name) == 0) {
+      placement->kind = kinds[k].kind;
+    }
+  }
+
+  if (placement->kind == PLACEMENT_NONE) {
+    return true;
+  }
+
+#ifdef __linux__
+  if (placement->kind == PLACEMENT_LIST) {
+    if (!read_list(placement, name)) {
+      placement_destroy(placement);
+      return false;
+    }
+    return true;
+  }
+
+  read_topology(placement);
+
+  if (placement->kind == PLACEMENT_CROSS_SOCKET && placement->num_packages < 2) {
+    fprintf(stderr, "Thread placement cross-socket: only one package, placing threads compact\n");
+  }
+  return true;
+#else
+  fprintf(stderr, "Thread placement %s is only supported on Linux\n", name);
+  return false;
+#endif
+}
+
+void placement_destroy(placement_t *placement) {
+  free(placement->cpus);
+  free(placement->package_start);
+  placement->cpus = NULL;
+  placement->package_start = NULL;
+}
+
+int placement_cpu(placement_t *placement, int i, int n) {
+  int *cpus = placement->cpus;
+
+  switch (placement->kind) {
+  case PLACEMENT_NONE:
+    return -1;
+
+  case PLACEMENT_SCATTER:
+    if (n < placement->num_cpus) {
+      return cpus[(long) i * placement->num_cpus / n];
+    }
+    return cpus[i % placement->num_cpus];
+
+  case PLACEMENT_CROSS_SOCKET: {
+    int p = i % placement->num_packages;
+    int start = placement->package_start[p];
+    int size = placement->package_start[p + 1] - start;
+
+    return cpus[start + (i / placement->num_packages) % size];
+  }
+
+  default:
+    return cpus[i % placement->num_cpus];
+  }
+}
+
+void placement_attr(placement_t *placement, pthread_attr_t *attr, int i, int n) {
+  int cpu = placement_cpu(placement, i, n);
+
+  if (cpu < 0) {
+    return;
+  }
+
+#ifdef __linux__
+  cpu_set_t set;
+
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+
+  int error = pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+
+  if (error != 0) {
+    fprintf(stderr, "Could not place thread %d on CPU %d: %s\n", i, cpu, strerror(error));
+    exit(EXIT_FAILURE);
+  }
+#else
+  (void) attr;
+#endif
+}
+
+void placement_print(placement_t *placement, int n) {
+  printf("Thread placement: %s\n", placement->name);
+
+  if (placement->kind == PLACEMENT_NONE) {
+    return;
+  }
+
+  printf("CPUs of threads 0 to %d:", n - 1);
+
+  for (int i = 0; i < n; i++) {
+    printf(" %d", placement_cpu(placement, i, n));
+  }
+  printf("\n");
+}
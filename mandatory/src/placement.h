@@ -0,0 +1,83 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <stdbool.h> // bool
+#include <pthread.h> // pthread_attr_t
+
+/* Placement of benchmark threads on CPUs, so that results can be reproduced
+   and explained by what the threads share.
+
+   The topology is read from /sys/devices/system/cpu, limited to the CPUs the
+   process may run on. Thread i of n is placed as follows.
+
+     none         - Left to the scheduler.
+     compact      - One thread per core of a package, then on the SMT siblings
+                    of those cores, before going on to the next package.
+     smt          - On the SMT siblings of a core before going on to the next
+                    core, so that threads 2i and 2i + 1 share a core if the
+                    cores have two hardware threads.
+     scatter      - Spread evenly over the CPUs in compact order, the n
+                    threads CPUs / n apart.
+     cross-socket - Alternately on each package, compact within a package, so
+                    that neighbouring threads never share a package.
+     list         - A comma separated list of CPUs and ranges of CPUs such as
+                    0,2,4-7, thread i going to the i-th CPU of the list.
+
+   With more threads than CPUs the CPUs are used again from the first.
+   Placements other than none are only supported on Linux.
+*/
+
+typedef enum {
+  PLACEMENT_NONE,
+  PLACEMENT_COMPACT,
+  PLACEMENT_SMT,
+  PLACEMENT_SCATTER,
+  PLACEMENT_CROSS_SOCKET,
+  PLACEMENT_LIST
+} placement_kind_t;
+
+typedef struct {
+  placement_kind_t kind;
+  const char *name;       // As given to placement_init().
+  int  num_cpus;
+  int *cpus;              // In compact order, or as listed.
+  int  num_packages;
+  int *package_start;     // Index of the first CPU of each package in cpus,
+                          // and num_cpus after the last.
+} placement_t;
+
+/* placement_init(placement, name)
+
+   Initializes placement from one of the names above or a list of CPUs.
+   Finalized with placement_destroy().
+
+   Return value
+
+   True on success, false if name is neither a placement nor a list of CPUs
+   the process may run on, after printing why.
+*/
+bool placement_init(placement_t *placement, const char *name);
+void placement_destroy(placement_t *placement);
+
+/* placement_cpu(placement, i, n)
+
+   Return value
+
+   The CPU of thread i of n, or -1 to leave the thread to the scheduler.
+*/
+int placement_cpu(placement_t *placement, int i, int n);
+
+/* placement_attr(placement, attr, i, n)
+
+   Sets the affinity of the initialized attr to the CPU of thread i of n, so
+   that a thread created with attr starts out on its CPU.
+*/
+void placement_attr(placement_t *placement, pthread_attr_t *attr, int i, int n);
+
+/* placement_print(placement, n)
+
+   Prints the CPU of each of n threads.
+*/
+void placement_print(placement_t *placement, int n);
+
+#endif
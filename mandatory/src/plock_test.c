@@ -0,0 +1,361 @@
+/**
+ * Unit test and benchmark of the reader-writer and ticket locks.
+ *
+ * Run without options for the unit tests. With -b, compares the locks with a
+ * psem_t used as a mutex guarding a small table that threads read and write
+ * at different ratios.
+ */
+
+#include <stdio.h>   // printf(), fprintf()
+#include <stdlib.h>  // exit(), atoi(), rand_r()
+#include <stdbool.h> // bool
+#include <unistd.h>  // usleep(), getopt()
+#include <pthread.h> // pthread_...
+#include <assert.h>  // assert()
+
+#include "psem.h"
+#include "plock.h"
+#include "timing.h"  // timing_start(), timing_stop()
+
+#define TEST_HEADER printf("\n==== %s ====\n\n", __FUNCTION__)
+
+#define THREADS    4
+#define ITERATIONS 20000
+
+void success() {
+  printf("\nTest SUCCESSFUL :-)\n\n");
+}
+
+/*******************************************************************************
+                                  Unit tests
+********************************************************************************/
+
+prwlock_t rwlock = PRWLOCK_INITIALIZER;
+pticket_t ticket = PTICKET_INITIALIZER;
+
+atomic_int readers;   // Threads holding rwlock for reading.
+atomic_int writers;   // Threads holding rwlock for writing.
+int counter;          // Guarded by the lock under test.
+
+/* Holds the lock for reading until another reader has joined it. */
+void *shared_reader(void *arg) {
+  (void) arg;
+
+  prwlock_read_lock(&rwlock);
+  atomic_fetch_add(&readers, 1);
+
+  while (atomic_load(&readers) < 2) {
+    usleep(1000);
+  }
+
+  prwlock_read_unlock(&rwlock);
+  pthread_exit(NULL);
+}
+
+void read_test() {
+  TEST_HEADER;
+
+  pthread_t tid[2];
+
+  atomic_store(&readers, 0);
+
+  // Would never return if readers excluded each other.
+  for (int i = 0; i < 2; i++) {
+    pthread_create(&tid[i], NULL, shared_reader, NULL);
+  }
+  for (int i = 0; i < 2; i++) {
+    pthread_join(tid[i], NULL);
+  }
+
+  success();
+}
+
+void *reader(void *arg) {
+  (void) arg;
+
+  for (int i = 0; i < ITERATIONS; i++) {
+    prwlock_read_lock(&rwlock);
+    atomic_fetch_add(&readers, 1);
+    assert(atomic_load(&writers) == 0);
+    atomic_fetch_sub(&readers, 1);
+    prwlock_read_unlock(&rwlock);
+  }
+  pthread_exit(NULL);
+}
+
+void *writer(void *arg) {
+  (void) arg;
+
+  for (int i = 0; i < ITERATIONS; i++) {
+    prwlock_write_lock(&rwlock);
+    assert(atomic_fetch_add(&writers, 1) == 0);
+    assert(atomic_load(&readers) == 0);
+    counter++;
+    atomic_fetch_sub(&writers, 1);
+    prwlock_write_unlock(&rwlock);
+  }
+  pthread_exit(NULL);
+}
+
+void exclusion_test() {
+  TEST_HEADER;
+
+  pthread_t tid[THREADS];
+
+  atomic_store(&readers, 0);
+  counter = 0;
+
+  for (int i = 0; i < THREADS; i++) {
+    pthread_create(&tid[i], NULL, (i % 2) ? writer : reader, NULL);
+  }
+  for (int i = 0; i < THREADS; i++) {
+    pthread_join(tid[i], NULL);
+  }
+
+  assert(counter == THREADS/2 * ITERATIONS);
+
+  success();
+}
+
+void *late_reader(void *arg) {
+  (void) arg;
+
+  prwlock_read_lock(&rwlock);
+  atomic_fetch_add(&readers, 1);
+  prwlock_read_unlock(&rwlock);
+  pthread_exit(NULL);
+}
+
+void *late_writer(void *arg) {
+  (void) arg;
+
+  prwlock_write_lock(&rwlock);
+  // The reader that came after this writer must still be waiting.
+  assert(atomic_load(&readers) == 0);
+  prwlock_write_unlock(&rwlock);
+  pthread_exit(NULL);
+}
+
+void preference_test() {
+  TEST_HEADER;
+
+  pthread_t w, r;
+
+  atomic_store(&readers, 0);
+
+  prwlock_read_lock(&rwlock);
+
+  // A writer waits for this thread, and a reader arriving after it waits for
+  // the writer although only readers hold the lock. Both threads count
+  // themselves in sleepers before they sleep.
+  pthread_create(&w, NULL, late_writer, NULL);
+  while (prwlock_writers_waiting(&rwlock) == 0) {
+    usleep(1000);
+  }
+  pthread_create(&r, NULL, late_reader, NULL);
+  while (atomic_load(&rwlock.sleepers) < 2) {
+    usleep(1000);
+  }
+
+  assert(atomic_load(&readers) == 0);
+  assert(prwlock_readers(&rwlock) == 1);
+
+  prwlock_read_unlock(&rwlock);
+
+  pthread_join(w, NULL);
+  pthread_join(r, NULL);
+
+  assert(atomic_load(&readers) == 1);
+
+  success();
+}
+
+void *ticket_thread(void *arg) {
+  (void) arg;
+
+  for (int i = 0; i < ITERATIONS; i++) {
+    pticket_lock(&ticket);
+    counter++;
+    pticket_unlock(&ticket);
+  }
+  pthread_exit(NULL);
+}
+
+void ticket_test() {
+  TEST_HEADER;
+
+  pthread_t tid[THREADS];
+
+  counter = 0;
+
+  for (int i = 0; i < THREADS; i++) {
+    pthread_create(&tid[i], NULL, ticket_thread, NULL);
+  }
+  for (int i = 0; i < THREADS; i++) {
+    pthread_join(tid[i], NULL);
+  }
+
+  assert(counter == THREADS * ITERATIONS);
+  assert(atomic_load(&ticket.next) == THREADS * ITERATIONS);
+  assert(atomic_load(&ticket.serving) == THREADS * ITERATIONS);
+
+  success();
+}
+
+/*******************************************************************************
+                                  Benchmark
+********************************************************************************/
+
+/* Readers sum the table, writers add one to every entry. Every reader checks
+   that it never sees a write half done. */
+#define TABLE 16
+
+typedef enum { PSEM, TICKET, RWLOCK } lock_kind_t;
+
+const char *lock_names[] = { "psem", "ticket", "rwlock" };
+
+typedef struct {
+  lock_kind_t kind;
+  int         read_percent;
+  int         ops;
+  unsigned    seed;
+} bench_t;
+
+psem_t    bench_sem = PSEM_INITIALIZER(1);
+pticket_t bench_ticket = PTICKET_INITIALIZER;
+prwlock_t bench_rwlock = PRWLOCK_INITIALIZER;
+
+int table[TABLE];
+
+void bench_lock(lock_kind_t kind, bool read) {
+  switch (kind) {
+  case PSEM:   psem_wait(&bench_sem); break;
+  case TICKET: pticket_lock(&bench_ticket); break;
+  case RWLOCK: read ? prwlock_read_lock(&bench_rwlock) : prwlock_write_lock(&bench_rwlock); break;
+  }
+}
+
+void bench_unlock(lock_kind_t kind, bool read) {
+  switch (kind) {
+  case PSEM:   psem_signal(&bench_sem); break;
+  case TICKET: pticket_unlock(&bench_ticket); break;
+  case RWLOCK: read ? prwlock_read_unlock(&bench_rwlock) : prwlock_write_unlock(&bench_rwlock); break;
+  }
+}
+
+void *bench_thread(void *arg) {
+  bench_t *b = (bench_t*) arg;
+
+  for (int i = 0; i < b->ops; i++) {
+    bool read = rand_r(&b->seed) % 100 < b->read_percent;
+
+    bench_lock(b->kind, read);
+
+    if (read) {
+      int sum = 0;
+
+      for (int j = 0; j < TABLE; j++) {
+        sum += table[j];
+      }
+      if (sum != TABLE*table[0]) {
+        fprintf(stderr, "A reader saw a write half done\n");
+        abort();
+      }
+    } else {
+      for (int j = 0; j < TABLE; j++) {
+        table[j]++;
+      }
+    }
+
+    bench_unlock(b->kind, read);
+  }
+  pthread_exit(NULL);
+}
+
+double bench_run(lock_kind_t kind, int read_percent, int threads, int ops) {
+  pthread_t tid[threads];
+  bench_t args[threads];
+  struct timespec start;
+
+  timing_start(&start);
+
+  for (int i = 0; i < threads; i++) {
+    args[i] = (bench_t) { kind, read_percent, ops, i + 1 };
+
+    if (pthread_create(&tid[i], NULL, bench_thread, &args[i]) != 0) {
+      perror("pthread_create");
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (int i = 0; i < threads; i++) {
+    pthread_join(tid[i], NULL);
+  }
+
+  return timing_stop(&start);
+}
+
+void bench(int threads, int ops) {
+  int ratios[] = { 0, 50, 90, 99, 100 };
+  int num_ratios = sizeof(ratios) / sizeof(ratios[0]);
+
+  printf("\n%d threads, %d operations each (ops/s)\n\n", threads, ops);
+  printf("%8s", "reads %");
+
+  for (lock_kind_t kind = PSEM; kind <= RWLOCK; kind++) {
+    printf("  %12s", lock_names[kind]);
+  }
+  printf("\n");
+
+  for (int r = 0; r < num_ratios; r++) {
+    printf("%8d", ratios[r]);
+
+    for (lock_kind_t kind = PSEM; kind <= RWLOCK; kind++) {
+      double time = bench_run(kind, ratios[r], threads, ops);
+
+      printf("  %12.4e", (double) threads * ops / time);
+    }
+    printf("\n");
+  }
+}
+
+void usage(char *argv[]) {
+  fprintf(stderr, "Usage: %s [-b] [-t threads] [-n operations]\n\n", argv[0]);
+  fprintf(stderr, "  -b  Benchmark the locks instead of testing them.\n");
+  fprintf(stderr, "  -t  Benchmark threads (default %d).\n", THREADS);
+  fprintf(stderr, "  -n  Operations per benchmark thread (default %d).\n", 10*ITERATIONS);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+  bool benchmark = false;
+  int threads = THREADS;
+  int ops = 10*ITERATIONS;
+  int opt;
+
+  setbuf(stdout, NULL);
+
+  while ((opt = getopt(argc, argv, "bt:n:")) != -1) {
+    switch (opt) {
+    case 'b': benchmark = true; break;
+    case 't': threads = atoi(optarg); break;
+    case 'n': ops = atoi(optarg); break;
+    default:  usage(argv);
+    }
+  }
+
+  if (threads < 1 || ops < 1) {
+    usage(argv);
+  }
+
+  if (benchmark) {
+    bench(threads, ops);
+    return EXIT_SUCCESS;
+  }
+
+  // Run tests.
+
+  read_test();
+  exclusion_test();
+  preference_test();
+  ticket_test();
+}
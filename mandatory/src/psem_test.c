@@ -2,6 +2,8 @@
 #include <unistd.h>  // sleep()
 #include <stdio.h>   // printf()
 #include <pthread.h> // pthread_create()
+#include <assert.h>  // assert()
+#include <sched.h>   // sched_yield()
 
 #include "psem.h"    // init_sem(), wait_sem(), signal_sem(), destroy_sem()
 
@@ -10,6 +12,15 @@
 
 psem_t *sem;         // Semaphore used to synchronize the main thread and the pthread.
 
+psem_t bulk = PSEM_INITIALIZER(0);  // Semaphore for the bulk operations.
+
+#define BULK_ROUNDS 1000   // Rounds of the bulk waiters.
+
+pevent_t event = PEVENT_INITIALIZER;  // Eventcount for the ready flags.
+atomic_int ready;                     // Set by the main thread, cleared by the waiter.
+
+#define EVENT_ROUNDS 1000  // Rounds of the event waiter.
+
 void *thread() {
   for (int i = 0; i < N; i++) {
     sleep(SLEEP);
@@ -18,6 +29,89 @@ void *thread() {
   pthread_exit(0);
 }
 
+/* Takes three units at a time. */
+void *bulk_waiter() {
+  for (int i = 0; i < BULK_ROUNDS; i++) {
+    psem_wait_n(&bulk, 3);
+  }
+  pthread_exit(0);
+}
+
+/* Takes one unit at a time. */
+void *single_waiter() {
+  for (int i = 0; i < 3*BULK_ROUNDS; i++) {
+    psem_wait(&bulk);
+  }
+  pthread_exit(0);
+}
+
+/* Single and bulk waiters share a semaphore signaled with psem_signal() and
+   psem_signal_n(). All units must be taken and no waiter left behind. */
+void bulk_test(void) {
+  pthread_t waiters[2];
+
+  printf("  bulk test ...\n");
+
+  pthread_create(&waiters[0], NULL, bulk_waiter, NULL);
+  pthread_create(&waiters[1], NULL, single_waiter, NULL);
+
+  for (int i = 0; i < BULK_ROUNDS; i++) {
+    psem_signal(&bulk);
+    psem_signal_n(&bulk, 2);
+    psem_signal_n(&bulk, 3);
+  }
+
+  pthread_join(waiters[0], NULL);
+  pthread_join(waiters[1], NULL);
+
+  assert(!psem_trywait(&bulk));
+  psem_fini(&bulk);
+
+  printf("  bulk test done.\n");
+}
+
+/* Waits for ready to be set, and clears it. */
+void *event_waiter() {
+  for (int i = 0; i < EVENT_ROUNDS; i++) {
+    while (!atomic_load(&ready)) {
+      unsigned int key = pevent_prepare_wait(&event);
+
+      if (atomic_load(&ready)) {
+        pevent_cancel_wait(&event);
+        break;
+      }
+      pevent_commit_wait(&event, key);
+    }
+    atomic_store(&ready, 0);
+  }
+  pthread_exit(0);
+}
+
+/* A flag is set and notified for a waiter which clears it again. A lost
+   wake-up would leave the waiter and then the main thread hanging. */
+void event_test(void) {
+  pthread_t waiter;
+
+  printf("  event test ...\n");
+
+  pthread_create(&waiter, NULL, event_waiter, NULL);
+
+  for (int i = 0; i < EVENT_ROUNDS; i++) {
+    while (atomic_load(&ready)) {
+      sched_yield();
+    }
+    atomic_store(&ready, 1);
+    pevent_notify(&event);
+  }
+
+  pthread_join(waiter, NULL);
+
+  assert(atomic_load(&event.waiters) == 0);
+  pevent_fini(&event);
+
+  printf("  event test done.\n");
+}
+
 int main(void) {
   pthread_t tid;
   sem = psem_init(0);
@@ -35,4 +129,7 @@ int main(void) {
 
   psem_destroy(sem);
 
+  bulk_test();
+  event_test();
+
 }
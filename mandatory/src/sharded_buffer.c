@@ -0,0 +1,161 @@
+#include "sharded_buffer.h"
+
+#include <stdint.h>         // intptr_t
+#include <stdio.h>          // printf(), fprintf()
+#include <stdlib.h>         // aligned_alloc(), exit()
+#include <pthread.h>        // pthread_...
+
+/*******************************************************************************
+                                   Home lanes
+********************************************************************************/
+
+/* The home lane of the calling thread, kept under key as lane + 1 so that a
+   thread without a home lane reads as NULL. */
+static int home_lane(sbuffer_t *buffer, pthread_key_t key, atomic_uint *next) {
+  intptr_t lane = (intptr_t) pthread_getspecific(key);
+
+  if (lane == 0) {
+    lane = atomic_fetch_add_explicit(next, 1, memory_order_relaxed) % buffer->num_lanes + 1;
+
+    if (pthread_setspecific(key, (void *) lane) != 0) {
+      perror("Could not set home lane");
+      exit(EXIT_FAILURE);
+    }
+  }
+  return lane - 1;
+}
+
+/*******************************************************************************
+                                Sleeping consumers
+********************************************************************************/
+
+/* A consumer that finds all lanes empty prepares to wait on the wake
+   eventcount, looks at all lanes once more and only then waits. A producer
+   notifies wake after putting its tuple, which costs a fence and a load of the
+   waiter count while no consumer waits. */
+
+/* Try the lanes once, starting with the home lane. */
+static int scan(sbuffer_t *buffer, int home, tuple_t *tuple) {
+  int closed = 0;
+
+  for (int i = 0; i < buffer->num_lanes; i++) {
+    int lane = (home + i) % buffer->num_lanes;
+    int status = buffer_try_get(&buffer->lanes[lane], tuple);
+
+    if (status == BUFFER_OK) return BUFFER_OK;
+    if (status == BUFFER_CLOSED) closed++;
+  }
+
+  return (closed == buffer->num_lanes) ? BUFFER_CLOSED : BUFFER_WOULDBLOCK;
+}
+
+/*******************************************************************************
+                                   Buffer API
+********************************************************************************/
+
+void sbuffer_init(sbuffer_t *buffer, int num_lanes, int lane_size, int flags) {
+
+  if (num_lanes < 1) {
+    fprintf(stderr, "A sharded buffer needs at least one lane, not %d\n", num_lanes);
+    exit(EXIT_FAILURE);
+  }
+
+  if (flags & BUFFER_SPSC) {
+    fprintf(stderr, "The lanes of a sharded buffer cannot be BUFFER_SPSC\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Each lane starts on a cache line boundary, as buffer_t is padded.
+  buffer->lanes = aligned_alloc(CACHE_LINE_SIZE, num_lanes*sizeof(buffer_t));
+
+  if (buffer->lanes == NULL) {
+    perror("Could not allocate buffer lanes");
+    exit(EXIT_FAILURE);
+  }
+
+  buffer->num_lanes = num_lanes;
+
+  for (int i = 0; i < num_lanes; i++) {
+    buffer_init_flags(&buffer->lanes[i], lane_size, flags | BUFFER_MPMC | BUFFER_POW2);
+  }
+
+  if (pthread_key_create(&buffer->put_key, NULL) != 0 ||
+      pthread_key_create(&buffer->get_key, NULL) != 0) {
+    perror("Could not create home lane keys");
+    exit(EXIT_FAILURE);
+  }
+
+  atomic_init(&buffer->next_put, 0);
+  atomic_init(&buffer->next_get, 0);
+
+  pevent_init_at(&buffer->wake);
+}
+
+void sbuffer_destroy(sbuffer_t *buffer) {
+  for (int i = 0; i < buffer->num_lanes; i++) {
+    buffer_destroy(&buffer->lanes[i]);
+  }
+
+  free(buffer->lanes);
+  buffer->lanes = NULL;
+
+  pthread_key_delete(buffer->put_key);
+  pthread_key_delete(buffer->get_key);
+
+  pevent_fini(&buffer->wake);
+}
+
+void sbuffer_print(sbuffer_t *buffer) {
+  for (int i = 0; i < buffer->num_lanes; i++) {
+    printf("Lane %d: ", i);
+    buffer_print(&buffer->lanes[i]);
+  }
+}
+
+int sbuffer_put(sbuffer_t *buffer, int a, int b) {
+  int lane = home_lane(buffer, buffer->put_key, &buffer->next_put);
+  int status = buffer_put(&buffer->lanes[lane], a, b);
+
+  if (status == BUFFER_OK) {
+    pevent_notify(&buffer->wake);
+  }
+  return status;
+}
+
+int sbuffer_try_get(sbuffer_t *buffer, tuple_t *tuple) {
+  int home = home_lane(buffer, buffer->get_key, &buffer->next_get);
+
+  return scan(buffer, home, tuple);
+}
+
+int sbuffer_get(sbuffer_t *buffer, tuple_t *tuple) {
+  int home = home_lane(buffer, buffer->get_key, &buffer->next_get);
+
+  for (;;) {
+    int status = scan(buffer, home, tuple);
+
+    if (status != BUFFER_WOULDBLOCK) {
+      return status;
+    }
+
+    unsigned int key = pevent_prepare_wait(&buffer->wake);
+
+    status = scan(buffer, home, tuple);
+
+    if (status != BUFFER_WOULDBLOCK) {
+      pevent_cancel_wait(&buffer->wake);
+      return status;
+    }
+
+    pevent_commit_wait(&buffer->wake, key);
+  }
+}
+
+void sbuffer_close(sbuffer_t *buffer) {
+  for (int i = 0; i < buffer->num_lanes; i++) {
+    buffer_close(&buffer->lanes[i]);
+  }
+
+  // Waiting consumers find all lanes closed, or drain them first.
+  pevent_notify_all(&buffer->wake);
+}
@@ -0,0 +1,79 @@
+#ifndef SHARDED_BUFFER_H
+#define SHARDED_BUFFER_H
+
+#include "bounded_buffer.h" // buffer_t, tuple_t, BUFFER_...
+
+/* A sharded buffer spreads tuples over a number of lanes, each a lock-free
+   BUFFER_MPMC bounded buffer of its own, so that producers and consumers do
+   not all meet on the same head and tail.
+
+   Each thread gets a home lane, handed out round robin the first time it puts
+   and the first time it gets. A producer always puts into its home lane, so
+   tuples from one producer are taken in the order they were put. A consumer
+   takes from its home lane first and steals from the other lanes when its
+   home lane is empty. Consumers only block when all lanes are empty.
+
+   With at least as many lanes as producers, producers never share a lane.
+*/
+
+typedef struct {
+  buffer_t *lanes;
+  int       num_lanes;
+
+  /* Home lanes of the calling thread as a producer and as a consumer, and the
+     next home lanes to hand out. */
+  pthread_key_t put_key;
+  pthread_key_t get_key;
+  atomic_uint   next_put;
+  atomic_uint   next_get;
+
+  /* Consumers that found all lanes empty wait on wake, which producers
+     only signal when a consumer waits. */
+  _Alignas(CACHE_LINE_SIZE) pevent_t wake;
+} sbuffer_t;
+
+/* sbuffer_init(buffer, num_lanes, lane_size, flags)
+
+   Initializes a sharded buffer of num_lanes lanes with room for lane_size
+   tuples each. The lanes are created with flags | BUFFER_MPMC | BUFFER_POW2,
+   flags may add BUFFER_ADAPTIVE and BUFFER_STATS.
+
+   A sharded buffer uses two pthread keys, of which there is a limited number
+   (PTHREAD_KEYS_MAX) per process.
+*/
+void sbuffer_init(sbuffer_t *buffer, int num_lanes, int lane_size, int flags);
+void sbuffer_destroy(sbuffer_t *buffer);
+void sbuffer_print(sbuffer_t *buffer);
+
+/* sbuffer_put(buffer, a, b)
+   sbuffer_get(buffer, tuple)
+
+   Put the tuple (a, b) into the home lane of the calling thread, waiting for
+   room in that lane, or get a tuple from any lane, waiting for data.
+
+   Return value
+
+   BUFFER_OK on success. BUFFER_CLOSED if the buffer was closed (put), or
+   closed with no tuples left in any lane (get).
+*/
+int sbuffer_put(sbuffer_t *buffer, int a, int b);
+int sbuffer_get(sbuffer_t *buffer, tuple_t *tuple);
+
+/* sbuffer_try_get(buffer, tuple)
+
+   Like sbuffer_get() but never waits for data.
+
+   Return value
+
+   BUFFER_OK on success, BUFFER_WOULDBLOCK if all lanes were empty,
+   BUFFER_CLOSED as for sbuffer_get().
+*/
+int sbuffer_try_get(sbuffer_t *buffer, tuple_t *tuple);
+
+/* sbuffer_close(buffer)
+
+   Closes all lanes, see buffer_close().
+*/
+void sbuffer_close(sbuffer_t *buffer);
+
+#endif
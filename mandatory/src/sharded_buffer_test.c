@@ -0,0 +1,212 @@
+/**
+ * Unit test for the sharded buffer.
+ */
+
+#include "sharded_buffer.h"
+
+#include <stdio.h>   // printf(), setbuf(), stdout
+#include <stdlib.h>  // EXIT_SUCCESS, EXIT_FAILURE
+#include <stddef.h>  // NULL
+#include <unistd.h>  // usleep()
+#include <pthread.h> // pthread_..
+#include <assert.h>  // assert()
+
+#define TEST_HEADER printf("\n==== %s ====\n\n", __FUNCTION__)
+
+#define PRODUCERS 4
+#define CONSUMERS 3
+#define ITEMS     2000
+
+void success() {
+  printf("\nTest SUCCESSFUL :-)\n\n");
+}
+
+void init_test() {
+  TEST_HEADER;
+
+  sbuffer_t buffer;
+
+  sbuffer_init(&buffer, 3, 5, 0);
+
+  assert(buffer.num_lanes == 3);
+
+  for (int i = 0; i < buffer.num_lanes; i++) {
+    assert(buffer.lanes[i].size == 8);
+    assert(buffer.lanes[i].flags & BUFFER_MPMC);
+  }
+
+  sbuffer_print(&buffer);
+  sbuffer_destroy(&buffer);
+
+  assert(buffer.lanes == NULL);
+
+  success();
+}
+
+void *get_one(void *arg) {
+  sbuffer_t *buffer = (sbuffer_t*) arg;
+  tuple_t tuple;
+
+  assert(sbuffer_get(buffer, &tuple) == BUFFER_OK);
+  assert(tuple.a == 0 && tuple.b == 0);
+  pthread_exit(NULL);
+}
+
+void steal_test() {
+  TEST_HEADER;
+
+  pthread_t tid;
+  sbuffer_t buffer;
+  tuple_t tuple;
+
+  sbuffer_init(&buffer, 2, 4, 0);
+
+  // All three tuples go into the home lane of this thread, lane 0.
+  for (int i = 0; i < 3; i++) {
+    assert(sbuffer_put(&buffer, 0, i) == BUFFER_OK);
+  }
+  assert(atomic_load(&buffer.lanes[0].head) == 3);
+
+  // The first consumer gets lane 0 as its home lane.
+  pthread_create(&tid, NULL, get_one, &buffer);
+  pthread_join(tid, NULL);
+
+  // This thread gets lane 1, which is empty, and steals from lane 0.
+  for (int i = 1; i < 3; i++) {
+    assert(sbuffer_get(&buffer, &tuple) == BUFFER_OK);
+    assert(tuple.a == 0 && tuple.b == i);
+  }
+
+  assert(sbuffer_try_get(&buffer, &tuple) == BUFFER_WOULDBLOCK);
+
+  sbuffer_destroy(&buffer);
+
+  success();
+}
+
+typedef struct {
+  sbuffer_t *buffer;
+  int id;
+  int count;
+} arg_t;
+
+void *producer(void *arg) {
+  arg_t *a = (arg_t*) arg;
+
+  for (int i = 0; i < ITEMS; i++) {
+    assert(sbuffer_put(a->buffer, a->id, i) == BUFFER_OK);
+  }
+  pthread_exit(NULL);
+}
+
+void *consumer(void *arg) {
+  arg_t *a = (arg_t*) arg;
+  int last[PRODUCERS];
+  tuple_t tuple;
+
+  for (int i = 0; i < PRODUCERS; i++) {
+    last[i] = -1;
+  }
+
+  // Tuples from each producer must arrive in the order they were put.
+  while (sbuffer_get(a->buffer, &tuple) == BUFFER_OK) {
+    assert(tuple.b > last[tuple.a]);
+    last[tuple.a] = tuple.b;
+    a->count++;
+  }
+  pthread_exit(NULL);
+}
+
+void fifo_test_lanes(int num_lanes) {
+  pthread_t producers[PRODUCERS], consumers[CONSUMERS];
+  arg_t pargs[PRODUCERS], cargs[CONSUMERS];
+  sbuffer_t buffer;
+  int count = 0;
+
+  sbuffer_init(&buffer, num_lanes, 4, 0);
+
+  for (int i = 0; i < CONSUMERS; i++) {
+    cargs[i] = (arg_t) { &buffer, i, 0 };
+    pthread_create(&consumers[i], NULL, consumer, &cargs[i]);
+  }
+
+  for (int i = 0; i < PRODUCERS; i++) {
+    pargs[i] = (arg_t) { &buffer, i, 0 };
+    pthread_create(&producers[i], NULL, producer, &pargs[i]);
+  }
+
+  for (int i = 0; i < PRODUCERS; i++) {
+    pthread_join(producers[i], NULL);
+  }
+
+  sbuffer_close(&buffer);
+
+  for (int i = 0; i < CONSUMERS; i++) {
+    pthread_join(consumers[i], NULL);
+    count += cargs[i].count;
+  }
+
+  printf("%d lanes: %d tuples\n", num_lanes, count);
+  assert(count == PRODUCERS*ITEMS);
+
+  sbuffer_destroy(&buffer);
+}
+
+void fifo_test() {
+  TEST_HEADER;
+
+  fifo_test_lanes(1);
+  fifo_test_lanes(2);
+  fifo_test_lanes(PRODUCERS);
+
+  success();
+}
+
+void *closed_getter(void *arg) {
+  sbuffer_t *buffer = (sbuffer_t*) arg;
+  tuple_t tuple;
+
+  assert(sbuffer_get(buffer, &tuple) == BUFFER_CLOSED);
+  pthread_exit(NULL);
+}
+
+void close_test() {
+  TEST_HEADER;
+
+  pthread_t tid[2];
+  sbuffer_t buffer;
+  tuple_t tuple;
+
+  sbuffer_init(&buffer, 2, 4, 0);
+
+  // Consumers sleeping on empty lanes are woken up by close.
+  for (int i = 0; i < 2; i++) {
+    pthread_create(&tid[i], NULL, closed_getter, &buffer);
+  }
+  usleep(20000);
+
+  sbuffer_close(&buffer);
+
+  for (int i = 0; i < 2; i++) {
+    pthread_join(tid[i], NULL);
+  }
+
+  assert(sbuffer_put(&buffer, 0, 0) == BUFFER_CLOSED);
+  assert(sbuffer_get(&buffer, &tuple) == BUFFER_CLOSED);
+  assert(sbuffer_try_get(&buffer, &tuple) == BUFFER_CLOSED);
+
+  sbuffer_destroy(&buffer);
+
+  success();
+}
+
+int main(void) {
+  setbuf(stdout, NULL);
+
+  // Run tests.
+
+  init_test();
+  steal_test();
+  fifo_test();
+  close_test();
+}